@@ -0,0 +1,445 @@
+#pragma once
+
+#include "dblayout.hpp"
+
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/uio.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define ASYNC_LOOKUP_URING
+#endif
+
+// Batched lookups in a flat or columns database read from the file instead of the page cache mapping.
+// Every key is a binary search run as a state machine: it issues the read of its next probe and waits, so
+// up to ASYNC_DEPTH reads are in flight at once and the disk queue, not the latency of one read, bounds a batch.
+// Once a range is as small as a radix bucket it is read whole and finished in memory, so with the radix directory
+// most searches take one read. The reads go through io_uring, or a pool of threads doing pread() where there is none.
+
+const u64 ASYNC_DEPTH = 256; // searches in flight
+const u64 ASYNC_RANGE_BYTES = 4 * RADIX_BUCKET_ITEMS * 2*sizeof(u64); // a range of keys this small is read whole, a mean radix bucket of a flat file
+const int ASYNC_PREAD_THREADS = 32;
+
+// reads in flight on one file, tag is returned with the bytes read or -errno
+#ifdef ASYNC_LOOKUP_URING
+class uringReads {
+public:
+    // false if the kernel has no io_uring or does not allow it
+    bool open(int fd, unsigned entries) {
+        file = fd;
+        io_uring_params params{};
+        ring = syscall(__NR_io_uring_setup, entries, &params);
+        if (ring < 0) {
+            return false;
+        }
+        sqBytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqBytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) {
+            sqBytes = cqBytes = std::max(sqBytes, cqBytes);
+        }
+        sqRing = mmap(nullptr, sqBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+        cqRing = single ? sqRing : mmap(nullptr, cqBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+        sqeBytes = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqeBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES));
+        if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqes == MAP_FAILED) {
+            close();
+            return false;
+        }
+        char* sq = static_cast<char*>(sqRing);
+        char* cq = static_cast<char*>(cqRing);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        iovecs.resize(params.sq_entries);
+        return true;
+    }
+    ~uringReads() {
+        close();
+    }
+
+    // the caller never has more reads in flight than the entries of open()
+    void read(u64 tag, void* buffer, u64 bytes, u64 offset) {
+        unsigned tail = *sqTail;
+        unsigned index = tail & sqMask;
+        iovecs[index] = {buffer, bytes};
+        io_uring_sqe& sqe = sqes[index];
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_READV; // READV is in every kernel with io_uring
+        sqe.fd = file;
+        sqe.addr = reinterpret_cast<u64>(&iovecs[index]);
+        sqe.len = 1;
+        sqe.off = offset;
+        sqe.user_data = tag;
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        unsubmitted++;
+    }
+
+    // submit the new reads, wait for at least one and call f(tag, result) for every finished one
+    template <class F>
+    void wait(F f) {
+        while (__atomic_load_n(cqTail, __ATOMIC_ACQUIRE) == *cqHead || unsubmitted > 0) {
+            long done = syscall(__NR_io_uring_enter, ring, unsubmitted, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (done < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                std::cerr << "Error waiting for io_uring: " << strerror(errno) << std::endl;
+                throw std::runtime_error("io_uring error");
+            }
+            unsubmitted -= done;
+        }
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            const io_uring_cqe& cqe = cqes[head & cqMask];
+            f(cqe.user_data, cqe.res);
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    }
+
+private:
+    void close() {
+        if (sqes && sqes != MAP_FAILED) {
+            munmap(sqes, sqeBytes);
+        }
+        if (cqRing && cqRing != MAP_FAILED && cqRing != sqRing) {
+            munmap(cqRing, cqBytes);
+        }
+        if (sqRing && sqRing != MAP_FAILED) {
+            munmap(sqRing, sqBytes);
+        }
+        sqes = nullptr;
+        sqRing = cqRing = nullptr;
+        if (ring >= 0) {
+            ::close(ring);
+            ring = -1;
+        }
+    }
+
+    int file = -1;
+    int ring = -1;
+    void* sqRing = nullptr;
+    void* cqRing = nullptr;
+    u64 sqBytes = 0, cqBytes = 0, sqeBytes = 0;
+    io_uring_sqe* sqes = nullptr;
+    io_uring_cqe* cqes = nullptr;
+    unsigned* sqTail = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned sqMask = 0, cqMask = 0;
+    unsigned unsubmitted = 0;
+    std::vector<iovec> iovecs;
+};
+#endif
+
+// the same reads as uringReads by threads that each wait for one pread()
+class preadReads {
+public:
+    preadReads(int fd, int threads) : file(fd) {
+        for (int i = 0; i < threads; i++) {
+            workers.emplace_back([this] { workerLoop(); });
+        }
+    }
+    ~preadReads() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    // Delete copy constructor and copy assignment operator
+    preadReads(const preadReads&) = delete;
+    preadReads& operator=(const preadReads&) = delete;
+
+    void read(u64 tag, void* buffer, u64 bytes, u64 offset) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            requests.push_back({tag, buffer, bytes, offset});
+        }
+        wake.notify_one();
+    }
+
+    template <class F>
+    void wait(F f) {
+        std::vector<std::pair<u64, int>> finished;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            done.wait(lock, [this] { return !completions.empty(); });
+            finished.swap(completions);
+        }
+        for (const auto& [tag, result] : finished) {
+            f(tag, result);
+        }
+    }
+
+private:
+    struct request {
+        u64 tag;
+        void* buffer;
+        u64 bytes;
+        u64 offset;
+    };
+
+    void workerLoop() {
+        for (;;) {
+            request r;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !requests.empty(); });
+                if (requests.empty()) {
+                    return;
+                }
+                r = requests.front();
+                requests.pop_front();
+            }
+            ssize_t n;
+            do {
+                n = pread(file, r.buffer, r.bytes, r.offset);
+            } while (n < 0 && errno == EINTR);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                completions.push_back({r.tag, n < 0 ? -errno : int(n)});
+            }
+            done.notify_one();
+        }
+    }
+
+    int file;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::deque<request> requests;
+    std::vector<std::pair<u64, int>> completions;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+};
+
+class asyncLookup {
+public:
+    // useUring false forces the pread() threads
+    explicit asyncLookup(const char* filename, bool useUring = true) {
+        fd = open(filename, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            std::cerr << "Error opening file: " << filename << std::endl;
+            throw std::runtime_error("File open error");
+        }
+        struct stat st;
+        dbHeader header;
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            std::cerr << "Error reading size of file: " << filename << std::endl;
+            throw std::runtime_error("File stat error");
+        }
+        if (u64(st.st_size) >= sizeof(header) && pread(fd, &header, sizeof(header), 0) == sizeof(header) && header.magic == DB_MAGIC) {
+            if (header.layout != DB_COLUMNS) {
+                ::close(fd);
+                std::cerr << "Async lookups need a flat or columns database, not " << dbLayoutName(header.layout) << "." << std::endl;
+                throw std::runtime_error("File format error");
+            }
+            size_ = header.size;
+            keyOffset = header.keyOffset;
+            valueOffset = header.valueOffset;
+            keyStride = sizeof(u64);
+        } else {
+            size_ = st.st_size / (2*sizeof(u64));
+        }
+        directory = std::make_unique<radixDirectory>(filename, size_);
+        slots.resize(ASYNC_DEPTH);
+        for (auto& slot : slots) {
+            slot.buffer.resize(ASYNC_RANGE_BYTES / sizeof(u64));
+        }
+        bool uring = false;
+#ifdef ASYNC_LOOKUP_URING
+        if (useUring) {
+            ring = std::make_unique<uringReads>();
+            uring = ring->open(fd, ASYNC_DEPTH);
+            if (!uring) {
+                ring.reset();
+            }
+        }
+#endif
+        if (!uring) {
+            threads = std::make_unique<preadReads>(fd, ASYNC_PREAD_THREADS);
+        }
+        std::cerr << "Opened " << size_ << " items from " << filename << " for async lookups (" << (uring ? "io_uring" : "pread threads") << ")." << std::endl;
+    }
+    ~asyncLookup() {
+#ifdef ASYNC_LOOKUP_URING
+        ring.reset();
+#endif
+        threads.reset();
+        ::close(fd);
+    }
+
+    // Delete copy constructor and copy assignment operator
+    asyncLookup(const asyncLookup&) = delete;
+    asyncLookup& operator=(const asyncLookup&) = delete;
+
+    u64 size() const { return size_; }
+
+    // call f(i, value) for every keys[i] in the database, the same as shapeDb::join() but in any order
+    template <class F>
+    void join(const std::vector<u64>& keys, F f) {
+        STATS_TIME(JOIN);
+        STATS_COUNT(JOIN_KEYS, keys.size());
+#ifdef ASYNC_LOOKUP_URING
+        if (ring) {
+            run(*ring, keys, f);
+            return;
+        }
+#endif
+        run(*threads, keys, f);
+    }
+
+private:
+    // the items of a range read whole, or the value of a found key in a columns database
+    struct search {
+        u64 key = 0; // the position in keys
+        u64 left = 0, right = 0;
+        u64 first = 0, count = 0; // the items read, count 0 for the value
+        std::vector<u64> buffer;
+    };
+
+    // read the next probe of the search, the whole range if it fits in one read
+    template <class Reads>
+    void probe(Reads& reads, u64 slot) {
+        search& s = slots[slot];
+        u64 itemBytes = keyStride;
+        if ((s.right - s.left) * itemBytes <= ASYNC_RANGE_BYTES) {
+            s.first = s.left;
+            s.count = s.right - s.left;
+        } else {
+            s.first = (s.left + s.right) / 2;
+            s.count = 1;
+        }
+        reads.read(slot, s.buffer.data(), s.count * itemBytes, keyOffset + s.first * itemBytes);
+    }
+
+    // start the search of keys[i] in slot, false if no item can match
+    template <class Reads>
+    bool start(Reads& reads, u64 slot, const std::vector<u64>& keys, u64 i) {
+        search& s = slots[slot];
+        s.key = i;
+        s.left = 0;
+        s.right = size_;
+        if (directory && !directory->range(keys[i], s.left, s.right)) {
+            return false;
+        }
+        if (s.left >= s.right) {
+            return false;
+        }
+        probe(reads, slot);
+        return true;
+    }
+
+    // go on with the search of slot after its read, false if it ended
+    template <class Reads, class F>
+    bool next(Reads& reads, u64 slot, const std::vector<u64>& keys, F& f) {
+        search& s = slots[slot];
+        u64 key = keys[s.key];
+        if (s.count == 0) {
+            f(s.key, s.buffer[0]);
+            return false;
+        }
+        u64 stride = keyStride / sizeof(u64);
+        if (s.count > 1) {
+            u64 pos = sortedFind(s.buffer.data(), stride, 0, s.count, key);
+            if (pos == DB_NONE) {
+                return false;
+            }
+            return found(reads, slot, f, s.first + pos, stride == 2 ? s.buffer[2*pos + 1] : 0);
+        }
+        u64 probed = s.buffer[0];
+        if (probed == key) {
+            return found(reads, slot, f, s.first, stride == 2 ? s.buffer[1] : 0);
+        }
+        if (probed < key) {
+            s.left = s.first + 1;
+        } else {
+            s.right = s.first;
+        }
+        if (s.left >= s.right) {
+            return false;
+        }
+        probe(reads, slot);
+        return true;
+    }
+
+    // the key is item pos, a flat item holds its value, a columns database reads it next
+    template <class Reads, class F>
+    bool found(Reads& reads, u64 slot, F& f, u64 pos, u64 value) {
+        search& s = slots[slot];
+        if (keyStride == 2*sizeof(u64)) {
+            f(s.key, value);
+            return false;
+        }
+        s.count = 0;
+        reads.read(slot, s.buffer.data(), sizeof(u64), valueOffset + pos * sizeof(u64));
+        return true;
+    }
+
+    template <class Reads, class F>
+    void run(Reads& reads, const std::vector<u64>& keys, F& f) {
+        std::vector<u64> free;
+        for (u64 slot = slots.size(); slot-- > 0; ) {
+            free.push_back(slot);
+        }
+        u64 started = 0;
+        u64 inFlight = 0;
+        for (;;) {
+            while (!free.empty() && started < keys.size()) {
+                u64 slot = free.back();
+                if (start(reads, slot, keys, started++)) {
+                    free.pop_back();
+                    inFlight++;
+                }
+            }
+            if (inFlight == 0) {
+                return;
+            }
+            reads.wait([&](u64 slot, int result) {
+                search& s = slots[slot];
+                u64 expected = s.count == 0 ? sizeof(u64) : s.count * keyStride;
+                STATS_COUNT(SEEKS, 1);
+                STATS_COUNT(BYTES_READ, expected);
+                if (result < 0 || u64(result) != expected) {
+                    std::cerr << "Error reading the database: " << (result < 0 ? strerror(-result) : "short read") << std::endl;
+                    throw std::runtime_error("File read error");
+                }
+                if (!next(reads, slot, keys, f)) {
+                    free.push_back(slot);
+                    inFlight--;
+                }
+            });
+        }
+    }
+
+    int fd = -1;
+    u64 size_ = 0;
+    u64 keyOffset = 0;
+    u64 valueOffset = 0;
+    u64 keyStride = 2*sizeof(u64); // bytes from one key to the next, a flat item holds the key and the value
+    std::unique_ptr<radixDirectory> directory;
+    std::vector<search> slots;
+#ifdef ASYNC_LOOKUP_URING
+    std::unique_ptr<uringReads> ring;
+#endif
+    std::unique_ptr<preadReads> threads;
+};
@@ -0,0 +1,229 @@
+#include "main.hpp"
+
+#include <cstdlib>
+#include <functional>
+#include <new>
+
+// Microbenchmarks of the Shape operations on a corpus of TEST_POINTS shapes, seeded from TEST_POINTS so every
+// version measures the same shapes. Every benchmark runs over the whole corpus until MIN_TIME passed, the setup
+// of a round (copying the shapes that the operation changes) is neither timed nor counted.
+
+const double MIN_TIME = 0.5; // seconds per benchmark
+
+// every operator new of the program is counted, the benchmarks are single threaded
+// new and delete go through one pair of functions that are not inlined, so the compiler sees no malloc to pair
+// with a delete
+u64 allocations = 0;
+
+__attribute__((noinline)) void* countedAlloc(std::size_t size) {
+    allocations++;
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+__attribute__((noinline)) void countedFree(void* p) noexcept {
+    std::free(p);
+}
+
+void* operator new(std::size_t size) { return countedAlloc(size); }
+void* operator new[](std::size_t size) { return countedAlloc(size); }
+void operator delete(void* p) noexcept { countedFree(p); }
+void operator delete[](void* p) noexcept { countedFree(p); }
+void operator delete(void* p, std::size_t) noexcept { countedFree(p); }
+void operator delete[](void* p, std::size_t) noexcept { countedFree(p); }
+
+// the results of the operations are summed in sink, so the compiler can not drop them
+volatile u64 sink = 0;
+
+std::vector<Shape> randomCorpus() {
+    std::mt19937_64 rng(TEST_POINTS);
+    std::vector<Shape> corpus;
+    corpus.reserve(TEST_POINTS);
+    while (corpus.size() < TEST_POINTS) {
+        corpus.push_back(randomShape(rng));
+    }
+    return corpus;
+}
+
+// TEST_POINTS shapes evenly spread over the database, with the colours of Shape(u64)
+std::vector<Shape> dbCorpus(const char* filename) {
+    const shapeDb db(filename, false, MADV_SEQUENTIAL);
+    u64 step = std::max<u64>(db.size() / TEST_POINTS, 1);
+    std::vector<Shape> corpus;
+    corpus.reserve(TEST_POINTS);
+    u64 i = 0;
+    db.forEach([&](u64 idx, u64) {
+        if (i++ % step == 0 && corpus.size() < TEST_POINTS) {
+            corpus.emplace_back(idx, QUAD_SIZE, MAX_HIGHT);
+        }
+    });
+    return corpus;
+}
+
+struct benchmark {
+    std::string name;
+    // setup(work) prepares a round untimed, run(work, i) does the operation on the i-th shape
+    std::function<void(std::vector<Shape>&)> setup;
+    std::function<u64(std::vector<Shape>&, size_t)> run;
+};
+
+struct benchmarkResult {
+    std::string name;
+    u64 iterations = 0;
+    double realTime = 0; // ns/op
+    double cpuTime = 0;  // ns/op
+    double allocations = 0; // per op
+};
+
+benchmarkResult runBenchmark(const benchmark& bench, size_t size) {
+    benchmarkResult result;
+    result.name = bench.name;
+    std::vector<Shape> work;
+    std::chrono::duration<double> real(0);
+    std::clock_t cpu = 0;
+    u64 allocs = 0;
+    u64 sum = 0;
+    // one untimed operation builds the lazy tables, as the half-shape table of separableAxis()
+    bench.setup(work);
+    sum += bench.run(work, 0);
+    while (real.count() < MIN_TIME) {
+        bench.setup(work);
+        u64 allocsBefore = allocations;
+        std::clock_t cpuStart = std::clock();
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < size; i++) {
+            sum += bench.run(work, i);
+        }
+        real += std::chrono::steady_clock::now() - start;
+        cpu += std::clock() - cpuStart;
+        allocs += allocations - allocsBefore;
+        result.iterations += size;
+    }
+    sink = sink + sum;
+    result.realTime = real.count() * 1e9 / result.iterations;
+    result.cpuTime = double(cpu) / CLOCKS_PER_SEC * 1e9 / result.iterations;
+    result.allocations = double(allocs) / result.iterations;
+    return result;
+}
+
+std::string jsonString(const std::string& s) {
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out + "\"";
+}
+
+// the format of Google Benchmark's --benchmark_format=json, plus allocs_per_op
+void printJson(const std::vector<benchmarkResult>& results, const std::string& corpus, size_t size) {
+    char date[64];
+    std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", std::localtime(&now));
+    std::cout << "{\n  \"context\": {\n";
+    std::cout << "    \"date\": " << jsonString(date) << ",\n";
+    std::cout << "    \"num_cpus\": " << std::thread::hardware_concurrency() << ",\n";
+    std::cout << "    \"compiler\": " << jsonString(__VERSION__) << ",\n";
+#ifdef __OPTIMIZE__
+    std::cout << "    \"library_build_type\": \"release\",\n";
+#else
+    std::cout << "    \"library_build_type\": \"debug\",\n";
+#endif
+    std::cout << "    \"corpus\": " << jsonString(corpus) << ",\n";
+    std::cout << "    \"corpus_size\": " << size << ",\n";
+    std::cout << "    \"seed\": " << TEST_POINTS << "\n  },\n";
+    std::cout << "  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const auto& r = results[i];
+        std::cout << "    {\n";
+        std::cout << "      \"name\": " << jsonString(r.name) << ",\n";
+        std::cout << "      \"run_name\": " << jsonString(r.name) << ",\n";
+        std::cout << "      \"run_type\": \"iteration\",\n";
+        std::cout << "      \"iterations\": " << r.iterations << ",\n";
+        std::cout << "      \"real_time\": " << r.realTime << ",\n";
+        std::cout << "      \"cpu_time\": " << r.cpuTime << ",\n";
+        std::cout << "      \"time_unit\": \"ns\",\n";
+        std::cout << "      \"allocs_per_op\": " << r.allocations << "\n";
+        std::cout << "    }" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    std::cout << "  ]\n}" << std::endl;
+}
+
+void printTable(const std::vector<benchmarkResult>& results) {
+    printf("%-32s %14s %14s %14s %12s\n", "Benchmark", "Time (ns/op)", "CPU (ns/op)", "Iterations", "Allocs/op");
+    for (const auto& r : results) {
+        printf("%-32s %14.1f %14.1f %14" PRIu64 " %12.2f\n", r.name.c_str(), r.realTime, r.cpuTime, r.iterations, r.allocations);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1 && std::string(argv[1]) != "table" && std::string(argv[1]) != "json") {
+        std::cerr << "Usage: " << argv[0] << " [table|json] [filter|-] [db_file]" << std::endl;
+        std::cerr << "runs the benchmarks whose name contains filter, on random shapes or shapes of db_file" << std::endl;
+        return 1;
+    }
+    bool json = argc > 1 && std::string(argv[1]) == "json";
+    std::string filter = argc > 2 && std::string(argv[2]) != "-" ? argv[2] : "";
+    std::string corpusName = argc > 3 ? argv[3] : "random";
+
+    const std::vector<Shape> corpus = argc > 3 ? dbCorpus(argv[3]) : randomCorpus();
+    if (corpus.empty()) {
+        std::cerr << "The corpus is empty." << std::endl;
+        return 1;
+    }
+    std::vector<std::string> strings;
+    for (const auto& shape : corpus) {
+        strings.push_back(shape.toString());
+    }
+    std::vector<Shape> stacks;
+    for (int mtd = 0; mtd < STACK_SHAPES; mtd++) {
+        stacks.emplace_back(STACK_SHAPE_STRINGS[mtd], MAX_HIGHT);
+    }
+    std::cerr << "Corpus of " << corpus.size() << " shapes (" << corpusName << ")." << std::endl;
+
+    auto none = [](std::vector<Shape>&) {};
+    auto copy = [&](std::vector<Shape>& work) { work = corpus; };
+    const std::vector<benchmark> benchmarks = {
+        {"Shape(std::string)", none, [&](std::vector<Shape>&, size_t i) {
+            return Shape(strings[i], MAX_HIGHT).shape.size();
+        }},
+        {"Shape::index", none, [&](std::vector<Shape>&, size_t i) {
+            return corpus[i].index();
+        }},
+        {"Shape::rotateToLeast", copy, [&](std::vector<Shape>& work, size_t i) {
+            return work[i].rotateToLeast().shape[0][0].type;
+        }},
+        {"Shape::isStableAll", none, [&](std::vector<Shape>&, size_t i) {
+            return corpus[i].isStableAll().size();
+        }},
+        {"Shape::fall", copy, [&](std::vector<Shape>& work, size_t i) {
+            return work[i].fall().shape.size();
+        }},
+        {"Shape::stackBase", copy, [&](std::vector<Shape>& work, size_t i) {
+            return work[i].stackBase(stacks[i % STACK_SHAPES]).shape.size();
+        }},
+        {"Shape::separableAxis", none, [&](std::vector<Shape>&, size_t i) {
+            return u64(corpus[i].separableAxis() + 1);
+        }},
+        {"Shape::isCreatableNoPinToStack", none, [&](std::vector<Shape>&, size_t i) {
+            return corpus[i].isCreatableNoPinToStack().bits;
+        }},
+    };
+
+    std::vector<benchmarkResult> results;
+    for (const auto& bench : benchmarks) {
+        if (bench.name.find(filter) != std::string::npos) {
+            results.push_back(runBenchmark(bench, corpus.size()));
+            std::cerr << "Finished " << bench.name << "." << std::endl;
+        }
+    }
+    if (json) {
+        printJson(results, corpusName, corpus.size());
+    } else {
+        printTable(results);
+    }
+    return 0;
+}
@@ -0,0 +1,72 @@
+#include "main.hpp"
+
+// true if both paths name one existing file, whatever the spelling of the paths
+bool sameFile(const char* a, const char* b) {
+    struct stat sa, sb;
+    return stat(a, &sa) == 0 && stat(b, &sb) == 0 && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 4) {
+        std::cerr << "Usage: " << argv[0] << " <in_file> <out_file> <flat|eytzinger|btree|radix|eliasfano|columns> [canonical]" << std::endl;
+        std::cerr << "radix writes a flat out_file and its radix directory, in_file as out_file only adds the directory" << std::endl;
+        std::cerr << "canonical keeps only the shapes that are the least of their rotations and mirror images" << std::endl;
+        return 1;
+    }
+    bool canonical = argc > 4 && std::string(argv[4]) == "canonical";
+    dbLayout layout;
+    if (!parseDbLayout(argv[3], layout)) {
+        std::cerr << "Unknown layout: " << argv[3] << std::endl;
+        return 1;
+    }
+    // the input stays mapped while the output is written, so only the radix directory may be added in place
+    bool inPlace = sameFile(argv[1], argv[2]);
+    if (inPlace && (canonical || layout != DB_RADIX)) {
+        std::cerr << "The converted database can not replace its input." << std::endl;
+        return 1;
+    }
+    const shapeDb in(argv[1], false, MADV_SEQUENTIAL);
+    auto start = std::chrono::steady_clock::now();
+    auto forEach = [&](auto f) {
+        in.forEach([&](u64 idx, u64 value) {
+            if (!canonical || PackedShape(idx).toCanonical().index() == idx) {
+                f(idx, value);
+            }
+        });
+    };
+    u64 size = in.size();
+    if (canonical) {
+        // the parser finds a shape by its canonical shape if its least rotation is not stored
+        size = 0;
+        u64 missing = 0;
+        in.forEach([&](u64 idx, u64) {
+            u64 key = PackedShape(idx).toCanonical().index();
+            if (key == idx) {
+                size++;
+            } else if (in.count(key) == 0) {
+                missing++;
+            }
+        });
+        std::cerr << "Keeping " << size << " canonical shapes of " << in.size() << "." << std::endl;
+        if (missing > 0) {
+            std::cerr << "Warning: " << missing << " shapes have no canonical shape in " << argv[1] << " and are dropped." << std::endl;
+        }
+    }
+    if (layout == DB_RADIX) {
+        if (inPlace) {
+            if (in.layout() != DB_FLAT && in.layout() != DB_COLUMNS) {
+                std::cerr << "The radix directory is only for flat and columns databases." << std::endl;
+                return 1;
+            }
+        } else if (!saveDb(argv[2], DB_FLAT, size, forEach)) {
+            return 1;
+        }
+        if (!saveRadix((std::string(argv[2]) + RADIX_SUFFIX).c_str(), size, forEach)) {
+            return 1;
+        }
+    } else if (!saveDb(argv[2], layout, size, forEach)) {
+        return 1;
+    }
+    std::cerr << "Converted in " << getTimeStringHMS(std::chrono::steady_clock::now() - start) << "." << std::endl;
+    return 0;
+}
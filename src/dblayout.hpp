@@ -0,0 +1,452 @@
+#pragma once
+
+#include "shape.hpp"
+#include "mmapfilemap.hpp"
+#include "eliasfano.hpp"
+#include "stats.hpp"
+
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// A database file is either the flat (idx, value) pair file of saveMapBinary(), which has no header,
+// or starts with a dbHeader. The magic is larger than any shape index, so it never starts a flat file.
+
+const u64 DB_MAGIC = 0x3142445A50414853; // "SHAPZDB1"
+const u64 DB_NONE = ~0ull;               // no slot
+const u64 DB_PAD_KEY = 0x7FFFFFFFFFFFFFFF; // the key of unused slots, larger than any index
+
+enum dbLayout : u64 {
+    DB_FLAT = 0,      // sorted (idx, value) pairs
+    DB_EYTZINGER = 1, // keys in BFS order from slot 1, then the values in the same order
+    DB_BTREE = 2,     // static B-tree of 64-byte nodes, node k has children k*9+1 .. k*9+9
+    DB_RADIX = 3,     // the radix directory sidecar of a flat file, slots+1 item offsets, reserved[0] is the bits
+    DB_ELIAS_FANO = 4, // Elias-Fano coded keys, then 48-bit values, reserved[0] is the low bits and reserved[1] the buckets
+    DB_COLUMNS = 5,   // sorted keys, then the values in the same order
+    DB_LAYOUTS
+};
+
+struct dbHeader {
+    u64 magic = DB_MAGIC;
+    u64 layout = DB_FLAT;
+    u64 size = 0;        // number of items
+    u64 slots = 0;       // number of key slots
+    u64 keyOffset = 0;   // bytes from the start of the file
+    u64 valueOffset = 0;
+    u64 reserved[2] = {0, 0};
+};
+static_assert(sizeof(dbHeader) == 64, "dbHeader must fill one cache line");
+
+const u64 BTREE_KEYS = 8; // keys per node, one cache line
+const u64 BTREE_CHILDREN = BTREE_KEYS + 1;
+
+inline const char* dbLayoutName(u64 layout) {
+    switch (layout) {
+    case DB_FLAT:
+        return "flat";
+    case DB_EYTZINGER:
+        return "eytzinger";
+    case DB_BTREE:
+        return "btree";
+    case DB_RADIX:
+        return "radix";
+    case DB_ELIAS_FANO:
+        return "eliasfano";
+    case DB_COLUMNS:
+        return "columns";
+    default:
+        return "unknown";
+    }
+}
+
+inline bool parseDbLayout(const std::string& name, dbLayout& layout) {
+    for (u64 l = DB_FLAT; l < DB_LAYOUTS; l++) {
+        if (name == dbLayoutName(l)) {
+            layout = dbLayout(l);
+            return true;
+        }
+    }
+    return false;
+}
+
+inline u64 dbSlots(u64 layout, u64 size) {
+    switch (layout) {
+    case DB_EYTZINGER:
+        return size + 1;
+    case DB_BTREE:
+        return (size + BTREE_KEYS - 1) / BTREE_KEYS * BTREE_KEYS;
+    default:
+        return size;
+    }
+}
+
+// the slots of the Eytzinger layout in key order
+class eytzingerOrder {
+    u64 n;
+    u64 k;
+public:
+    eytzingerOrder(u64 size) : n(size), k(size == 0 ? 0 : 1) {
+        while (k != 0 && 2*k <= n) {
+            k = 2*k;
+        }
+    }
+    // return DB_NONE after the last slot
+    u64 next() {
+        if (k == 0) {
+            return DB_NONE;
+        }
+        u64 slot = k;
+        if (2*k + 1 <= n) {
+            k = 2*k + 1;
+            while (2*k <= n) {
+                k = 2*k;
+            }
+        } else {
+            while (k & 1) {
+                k >>= 1;
+            }
+            k >>= 1;
+        }
+        return slot;
+    }
+};
+
+// the slots of the columns layout in key order
+class linearOrder {
+    u64 slot = 0;
+public:
+    u64 next() { return slot++; }
+};
+
+// the slots of the B-tree layout in key order
+class btreeOrder {
+    u64 nodes;
+    u64 stackNode[64];
+    u64 stackKey[64];
+    int depth = 0;
+
+    void descend(u64 k) {
+        while (k < nodes) {
+            stackNode[depth] = k;
+            stackKey[depth++] = 0;
+            k = k * BTREE_CHILDREN + 1;
+        }
+    }
+public:
+    btreeOrder(u64 slots) : nodes(slots / BTREE_KEYS) {
+        descend(0);
+    }
+    // return DB_NONE after the last slot
+    u64 next() {
+        if (depth == 0) {
+            return DB_NONE;
+        }
+        u64 k = stackNode[depth-1];
+        u64 i = stackKey[depth-1]++;
+        if (i + 1 == BTREE_KEYS) {
+            depth--;
+        }
+        descend(k * BTREE_CHILDREN + i + 2);
+        return k * BTREE_KEYS + i;
+    }
+};
+
+// return the slot of idx in the Eytzinger keys, DB_NONE if not found
+inline u64 eytzingerFind(const u64* keys, u64 size, u64 idx) {
+    u64 k = 1;
+    while (k <= size) {
+        STATS_COUNT(PROBES, 1);
+        __builtin_prefetch(keys + 8*k); // the keys 3 levels down share one cache line
+        k = 2*k + (keys[k] < idx);
+    }
+    k >>= std::countr_one(k) + 1;
+    return (k != 0 && keys[k] == idx) ? k : DB_NONE;
+}
+
+// return the slot of idx in the B-tree keys, DB_NONE if not found
+inline u64 btreeFind(const u64* keys, u64 slots, u64 idx) {
+    u64 nodes = slots / BTREE_KEYS;
+    u64 found = DB_NONE;
+    u64 k = 0;
+    while (k < nodes) {
+        u64 child = k * BTREE_CHILDREN + 1;
+        if (child < nodes) {
+            // the children are known before this node is read, fetch them together
+            for (u64 i = 0; i < BTREE_CHILDREN; i++) {
+                __builtin_prefetch(keys + (child + i) * BTREE_KEYS);
+            }
+        }
+        const u64* node = keys + k * BTREE_KEYS;
+        STATS_COUNT(PROBES, 1);
+        u64 rank = 0;
+        for (u64 i = 0; i < BTREE_KEYS; i++) {
+            rank += node[i] < idx;
+        }
+        if (rank < BTREE_KEYS) {
+            found = k * BTREE_KEYS + rank;
+        }
+        k = child + rank;
+    }
+    return (found != DB_NONE && keys[found] == idx) ? found : DB_NONE;
+}
+
+// return the first position in the sorted keys [left, right) with key >= idx, every stride-th u64 is a key
+inline u64 sortedLowerBound(const u64* keys, u64 stride, u64 left, u64 right, u64 idx) {
+    u64 len = right - left;
+    while (len > 0) {
+        STATS_COUNT(PROBES, 1);
+        u64 half = len / 2;
+        if (keys[stride*(left + half)] < idx) {
+            left += half + 1;
+            len -= half + 1;
+        } else {
+            len = half;
+        }
+    }
+    return left;
+}
+
+// return the position of idx in the sorted keys [left, right), every stride-th u64 is a key, DB_NONE if not found
+inline u64 sortedFind(const u64* keys, u64 stride, u64 left, u64 right, u64 idx) {
+    left = sortedLowerBound(keys, stride, left, right, idx);
+    return (left < right && keys[stride*left] == idx) ? left : DB_NONE;
+}
+
+inline u64 alignCacheLine(u64 bytes) {
+    return (bytes + 63) / 64 * 64;
+}
+
+// map a new file of bytes zeroed bytes for writing, return nullptr on error
+inline char* createMapped(const char* outFile, u64 bytes) {
+    int fd = open(outFile, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, bytes) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        std::cerr << "Error opening " << outFile << " for writing." << std::endl;
+        return nullptr;
+    }
+    void* addr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        std::cerr << "Error mapping " << outFile << " for writing." << std::endl;
+        return nullptr;
+    }
+    return static_cast<char*>(addr);
+}
+
+// save the items to outFile with Elias-Fano coded keys and 48-bit values
+// forEach(f) is called twice, it must call f(idx, value) for size items in increasing idx
+template <class ForEach>
+bool saveEliasFano(const char* outFile, u64 size, ForEach forEach) {
+    u64 maxKey = 0;
+    bool fits = true;
+    forEach([&](u64 idx, u64 value) {
+        maxKey = idx;
+        fits = fits && (value & ~EF_VALUE_MASK) == 0;
+    });
+    if (!fits) {
+        std::cerr << "Values of more than " << 8 * EF_VALUE_BYTES << " bits can not be saved to " << outFile << "." << std::endl;
+        return false;
+    }
+    int lowBits = efLowBits(size, maxKey);
+    efSizes sizes(size, lowBits, size == 0 ? 0 : (maxKey >> lowBits) + 1);
+
+    dbHeader header;
+    header.layout = DB_ELIAS_FANO;
+    header.size = size;
+    header.slots = size;
+    header.keyOffset = sizeof(dbHeader);
+    header.valueOffset = header.keyOffset + alignCacheLine(sizes.words() * sizeof(u64));
+    header.reserved[0] = sizes.lowBits;
+    header.reserved[1] = sizes.buckets;
+    u64 bytes = header.valueOffset + size * EF_VALUE_BYTES + sizeof(u64) - EF_VALUE_BYTES;
+
+    char* base = createMapped(outFile, bytes);
+    if (!base) {
+        return false;
+    }
+    memcpy(base, &header, sizeof(header));
+    eliasFano::encode(reinterpret_cast<u64*>(base + header.keyOffset), sizes, [&](auto f) {
+        forEach([&](u64 idx, u64) { f(idx); });
+    });
+    char* values = base + header.valueOffset;
+    forEach([&](u64, u64 value) {
+        memcpy(values, &value, EF_VALUE_BYTES);
+        values += EF_VALUE_BYTES;
+    });
+    munmap(base, bytes);
+    std::cerr << "Saved " << size << " shapes to " << outFile << " (" << dbLayoutName(DB_ELIAS_FANO) << ", "
+              << bytes << " bytes, " << (size == 0 ? 0.0 : 8.0 * bytes / size) << " bits per shape)." << std::endl;
+    return true;
+}
+
+// save the items to outFile in the layout
+// forEach(f) must call f(idx, value) for size items in increasing idx, it may be called more than once
+template <class ForEach>
+bool saveDb(const char* outFile, dbLayout layout, u64 size, ForEach forEach) {
+    if (layout == DB_ELIAS_FANO) {
+        return saveEliasFano(outFile, size, forEach);
+    }
+    if (layout == DB_FLAT) {
+        auto file = fopen(outFile, "wb");
+        if (!file) {
+            std::cerr << "Error opening " << outFile << " for writing." << std::endl;
+            return false;
+        }
+        forEach([&](u64 idx, u64 value) {
+            fwrite(&idx, sizeof(idx), 1, file);
+            fwrite(&value, sizeof(value), 1, file);
+        });
+        fclose(file);
+        std::cerr << "Saved " << size << " shapes to " << outFile << " (flat)." << std::endl;
+        return true;
+    }
+
+    dbHeader header;
+    header.layout = layout;
+    header.size = size;
+    header.slots = dbSlots(layout, size);
+    header.keyOffset = sizeof(dbHeader);
+    header.valueOffset = header.keyOffset + alignCacheLine(header.slots * sizeof(u64));
+    u64 bytes = header.valueOffset + header.slots * sizeof(u64);
+
+    char* base = createMapped(outFile, bytes);
+    if (!base) {
+        return false;
+    }
+    memcpy(base, &header, sizeof(header));
+    u64* keys = reinterpret_cast<u64*>(base + header.keyOffset);
+    u64* values = reinterpret_cast<u64*>(base + header.valueOffset);
+    std::fill(keys, keys + header.slots, DB_PAD_KEY);
+
+    auto fill = [&](auto order) {
+        forEach([&](u64 idx, u64 value) {
+            u64 slot = order.next();
+            keys[slot] = idx;
+            values[slot] = value;
+        });
+    };
+    if (layout == DB_EYTZINGER) {
+        fill(eytzingerOrder(size));
+    } else if (layout == DB_BTREE) {
+        fill(btreeOrder(header.slots));
+    } else {
+        fill(linearOrder());
+    }
+    munmap(base, bytes);
+    std::cerr << "Saved " << size << " shapes to " << outFile << " (" << dbLayoutName(layout) << ")." << std::endl;
+    return true;
+}
+
+// The radix directory splits the sorted keys into buckets by their leading bits.
+// Short shapes have small indexes, so the buckets are log-linear: every index below 2^bits has its own bucket,
+// then every bit length has 2^(bits-1) buckets. The bucket of an index never decreases with the index.
+
+const char* const RADIX_SUFFIX = ".radix";
+const u64 RADIX_BUCKET_ITEMS = 256; // 4KB of flat items, one page
+
+inline u64 radixBucket(u64 idx, int bits) {
+    int length = 64 - std::countl_zero(idx);
+    if (length <= bits) {
+        return idx;
+    }
+    int shift = length - bits;
+    return (idx >> shift) + (u64(shift) << (bits - 1));
+}
+
+// most items are the tallest shapes, which fill the last few bit lengths
+inline int radixBits(u64 size) {
+    int bits = 64 - std::countl_zero(size / (4 * RADIX_BUCKET_ITEMS));
+    return std::clamp(bits, 8, 24);
+}
+
+// save the radix directory of size sorted items to outFile
+// forEach(f) must call f(idx, value) for size items in increasing idx
+template <class ForEach>
+bool saveRadix(const char* outFile, u64 size, ForEach forEach, int bits = 0) {
+    if (bits <= 0) {
+        bits = radixBits(size);
+    }
+    std::vector<u64> offsets;
+    u64 position = 0;
+    forEach([&](u64 idx, u64) {
+        u64 bucket = radixBucket(idx, bits);
+        while (offsets.size() <= bucket) {
+            offsets.push_back(position);
+        }
+        position++;
+    });
+    offsets.push_back(position);
+
+    dbHeader header;
+    header.layout = DB_RADIX;
+    header.size = size;
+    header.slots = offsets.size() - 1;
+    header.keyOffset = sizeof(dbHeader);
+    header.reserved[0] = bits;
+    auto file = fopen(outFile, "wb");
+    if (!file) {
+        std::cerr << "Error opening " << outFile << " for writing." << std::endl;
+        return false;
+    }
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(offsets.data(), sizeof(u64), offsets.size(), file);
+    fclose(file);
+    std::cerr << "Saved " << header.slots << " radix buckets of " << bits << " bits to " << outFile << "." << std::endl;
+    return true;
+}
+
+// the radix directory of a flat or columns database, read from the sidecar file next to it if there is one
+class radixDirectory {
+public:
+    radixDirectory(const char* dbFile, u64 size) {
+        std::string name = std::string(dbFile) + RADIX_SUFFIX;
+        if (access(name.c_str(), R_OK) != 0) {
+            return;
+        }
+        file = std::make_unique<mappedFile>(name.c_str(), true, MADV_WILLNEED);
+        dbHeader header;
+        if (file->size() >= sizeof(header)) {
+            memcpy(&header, file->data(), sizeof(header));
+        }
+        if (file->size() < sizeof(header) || header.magic != DB_MAGIC || header.layout != DB_RADIX || header.size != size
+            || file->size() < header.keyOffset + (header.slots + 1) * sizeof(u64)) {
+            std::cerr << "Ignoring radix directory " << name << " that does not match the database." << std::endl;
+            file.reset();
+            return;
+        }
+        bits = header.reserved[0];
+        buckets = header.slots;
+        offsets = reinterpret_cast<const u64*>(file->data() + header.keyOffset);
+        std::cerr << "Mapped " << buckets << " radix buckets from " << name << "." << std::endl;
+    }
+
+    bool empty() const { return offsets == nullptr; }
+
+    // narrow [left, right) to the bucket of idx, return false if idx can not be in the database
+    bool range(u64 idx, u64& left, u64& right) const {
+        if (!offsets) {
+            return true;
+        }
+        u64 bucket = radixBucket(idx, bits);
+        if (bucket >= buckets) {
+            return false;
+        }
+        left = offsets[bucket];
+        right = offsets[bucket + 1];
+        return left < right;
+    }
+
+private:
+    std::unique_ptr<mappedFile> file;
+    int bits = 0;
+    u64 buckets = 0;
+    const u64* offsets = nullptr;
+};
@@ -0,0 +1,172 @@
+#pragma once
+
+#include "shape.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+// Elias-Fano coding of a sorted key sequence.
+// Every key is split into its low lowBits bits, packed one after another in the lower words,
+// and its high bits h, stored as a one at bit (h + i) of the upper words for the i-th key.
+// So the keys with high bits h are the ones after the h-th zero, and the upper words take 2 bits per key.
+// Every EF_SAMPLE-th zero of the upper words is sampled to jump close to the keys of any h.
+
+const u64 EF_SAMPLE = 256;
+const u64 EF_VALUE_BYTES = 6; // values are packed to 48 bits, a 40-bit parent and an 8-bit method
+const u64 EF_VALUE_MASK = (1ull << (8 * EF_VALUE_BYTES)) - 1;
+
+// the low bits that keep the upper words at about 2 bits per key
+inline int efLowBits(u64 size, u64 maxKey) {
+    if (size == 0 || maxKey / size == 0) {
+        return 0;
+    }
+    return 63 - std::countl_zero(maxKey / size);
+}
+
+// the word sizes of the coded sequence, lower words, upper words and samples follow each other
+struct efSizes {
+    u64 size = 0;
+    int lowBits = 0;
+    u64 buckets = 0; // the number of different high bits, so the number of zeros in the upper words
+    u64 lowerWords = 0;
+    u64 upperWords = 0;
+    u64 sampleWords = 0;
+
+    efSizes() = default;
+    efSizes(u64 size, int lowBits, u64 buckets) : size(size), lowBits(lowBits), buckets(buckets) {
+        lowerWords = (size * lowBits + 63) / 64 + 1; // one more word to read a straddling key with two loads
+        upperWords = (size + buckets + 63) / 64 + 1;
+        sampleWords = (buckets + EF_SAMPLE - 1) / EF_SAMPLE;
+    }
+    u64 words() const { return lowerWords + upperWords + sampleWords; }
+};
+
+// the position of the r-th set bit of word, r from 0
+inline int selectInWord(u64 word, u64 r) {
+#ifdef __BMI2__
+    return std::countr_zero(_pdep_u64(1ull << r, word));
+#else
+    for (u64 i = 0; i < r; i++) {
+        word &= word - 1;
+    }
+    return std::countr_zero(word);
+#endif
+}
+
+// a read-only view of the coded keys, the words must be zero past the coded bits
+class eliasFano {
+public:
+    eliasFano() = default;
+    eliasFano(const u64* words, const efSizes& sizes)
+        : sizes(sizes), lower(words), upper(words + sizes.lowerWords), samples(upper + sizes.upperWords),
+          lowMask(sizes.lowBits == 0 ? 0 : ~0ull >> (64 - sizes.lowBits)) {}
+
+    u64 size() const { return sizes.size; }
+
+    // return the position of idx in the sequence, ~0ull (DB_NONE) if not found
+    u64 find(u64 idx) const {
+        u64 high = idx >> sizes.lowBits;
+        if (high >= sizes.buckets) {
+            return ~0ull;
+        }
+        u64 pos = high == 0 ? 0 : selectZero(high - 1) + 1;
+        u64 low = idx & lowMask;
+        for (u64 i = pos - high; (upper[pos / 64] >> (pos % 64)) & 1; i++, pos++) {
+            u64 l = lowAt(i);
+            if (l >= low) {
+                return l == low ? i : ~0ull;
+            }
+        }
+        return ~0ull;
+    }
+
+    // call f(i, key) for every key in order
+    template <class F>
+    void forEach(F f) const {
+        u64 i = 0;
+        for (u64 w = 0; i < sizes.size; w++) {
+            for (u64 word = upper[w]; word && i < sizes.size; word &= word - 1, i++) {
+                u64 high = w * 64 + std::countr_zero(word) - i;
+                f(i, (high << sizes.lowBits) | lowAt(i));
+            }
+        }
+    }
+
+    // write the keys to words, which must be sizes.words() zeroed words
+    // forEach(f) must call f(idx) for sizes.size keys in increasing idx
+    template <class ForEach>
+    static void encode(u64* words, const efSizes& sizes, ForEach forEach) {
+        u64* lower = words;
+        u64* upper = words + sizes.lowerWords;
+        u64* samples = upper + sizes.upperWords;
+        u64 i = 0;
+        forEach([&](u64 idx) {
+            if (sizes.lowBits > 0) {
+                u64 low = idx & (~0ull >> (64 - sizes.lowBits));
+                u64 bit = i * sizes.lowBits;
+                lower[bit / 64] |= low << (bit % 64);
+                if (bit % 64 + sizes.lowBits > 64) {
+                    lower[bit / 64 + 1] |= low >> (64 - bit % 64);
+                }
+            }
+            u64 pos = (idx >> sizes.lowBits) + i;
+            upper[pos / 64] |= 1ull << (pos % 64);
+            i++;
+        });
+        u64 zeros = 0;
+        for (u64 pos = 0; zeros < sizes.buckets; pos++) {
+            if (!((upper[pos / 64] >> (pos % 64)) & 1)) {
+                if (zeros % EF_SAMPLE == 0) {
+                    samples[zeros / EF_SAMPLE] = pos;
+                }
+                zeros++;
+            }
+        }
+    }
+
+private:
+    efSizes sizes;
+    const u64* lower = nullptr;
+    const u64* upper = nullptr;
+    const u64* samples = nullptr;
+    u64 lowMask = 0;
+
+    u64 lowAt(u64 i) const {
+        if (sizes.lowBits == 0) {
+            return 0;
+        }
+        u64 bit = i * sizes.lowBits;
+        u64 x = lower[bit / 64] >> (bit % 64);
+        if (bit % 64 + sizes.lowBits > 64) {
+            x |= lower[bit / 64 + 1] << (64 - bit % 64);
+        }
+        return x & lowMask;
+    }
+
+    // the position of the k-th zero of the upper words, k from 0
+    u64 selectZero(u64 k) const {
+        u64 pos = samples[k / EF_SAMPLE];
+        u64 rest = k % EF_SAMPLE;
+        u64 w = pos / 64;
+        u64 word = ~upper[w] & (~0ull << (pos % 64));
+        for (;;) {
+            u64 zeros = std::popcount(word);
+            if (rest < zeros) {
+                return w * 64 + selectInWord(word, rest);
+            }
+            rest -= zeros;
+            word = ~upper[++w];
+        }
+    }
+};
+
+// the 48-bit value at position i of the packed values, which need 2 bytes of padding after the last one
+inline u64 efValue(const char* values, u64 i) {
+    u64 x;
+    memcpy(&x, values + i * EF_VALUE_BYTES, sizeof(x));
+    return x & EF_VALUE_MASK;
+}
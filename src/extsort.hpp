@@ -0,0 +1,168 @@
+#pragma once
+
+#include "shape.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Sorting and merging of files of fixed size records that do not fit in memory.
+// A run is a file of records in increasing order.
+
+const u64 RUN_BUFFER_ITEMS = 1 << 14; // records buffered per reader and writer
+
+// append records to a file through a buffer
+template <class T>
+class runWriter {
+public:
+    runWriter(const std::string& filename, bool append = false) : name(filename) {
+        file = fopen(filename.c_str(), append ? "ab" : "wb");
+        if (!file) {
+            std::cerr << "Error opening " << filename << " for writing." << std::endl;
+            throw std::runtime_error("File open error");
+        }
+        buffer.reserve(RUN_BUFFER_ITEMS);
+    }
+    ~runWriter() {
+        close();
+    }
+
+    // Delete copy constructor and copy assignment operator
+    runWriter(const runWriter&) = delete;
+    runWriter& operator=(const runWriter&) = delete;
+
+    void push(const T& item) {
+        buffer.push_back(item);
+        count_++;
+        if (buffer.size() == RUN_BUFFER_ITEMS) {
+            flush();
+        }
+    }
+    void write(const T* items, u64 n) {
+        flush();
+        if (fwrite(items, sizeof(T), n, file) != n) {
+            std::cerr << "Error writing " << name << "." << std::endl;
+            throw std::runtime_error("File write error");
+        }
+        count_ += n;
+    }
+    void flush() {
+        if (!buffer.empty() && fwrite(buffer.data(), sizeof(T), buffer.size(), file) != buffer.size()) {
+            std::cerr << "Error writing " << name << "." << std::endl;
+            throw std::runtime_error("File write error");
+        }
+        buffer.clear();
+    }
+    void close() {
+        if (file) {
+            flush();
+            fclose(file);
+            file = nullptr;
+        }
+    }
+    u64 count() const { return count_; }
+
+private:
+    std::string name;
+    FILE* file = nullptr;
+    std::vector<T> buffer;
+    u64 count_ = 0;
+};
+
+// read the records of a file in order through a buffer
+template <class T>
+class runReader {
+public:
+    // a missing file reads as empty
+    runReader(const std::string& filename) {
+        file = fopen(filename.c_str(), "rb");
+        buffer.resize(RUN_BUFFER_ITEMS);
+        fill();
+    }
+    ~runReader() {
+        if (file) {
+            fclose(file);
+        }
+    }
+
+    // Delete copy constructor and copy assignment operator
+    runReader(const runReader&) = delete;
+    runReader& operator=(const runReader&) = delete;
+
+    bool empty() const { return now == end; }
+    const T& peek() const { return buffer[now]; }
+    T next() {
+        T item = buffer[now++];
+        if (now == end) {
+            fill();
+        }
+        return item;
+    }
+
+private:
+    FILE* file = nullptr;
+    std::vector<T> buffer;
+    u64 now = 0;
+    u64 end = 0;
+
+    void fill() {
+        now = 0;
+        end = file ? fread(buffer.data(), sizeof(T), buffer.size(), file) : 0;
+    }
+};
+
+// split the records of filename into sorted runs of at most budget records, named runPrefix + number
+// the file is removed, return the names of the runs
+template <class T>
+std::vector<std::string> sortIntoRuns(const std::string& filename, u64 budget, const std::string& runPrefix) {
+    std::vector<std::string> runs;
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (!file) {
+        return runs;
+    }
+    fseek(file, 0, SEEK_END);
+    u64 total = ftell(file) / sizeof(T);
+    fseek(file, 0, SEEK_SET);
+    std::vector<T> items(std::clamp<u64>(total, 1, std::max<u64>(budget, 1)));
+    for (;;) {
+        u64 n = fread(items.data(), sizeof(T), items.size(), file);
+        if (n == 0) {
+            break;
+        }
+        std::sort(items.begin(), items.begin() + n);
+        runs.push_back(runPrefix + std::to_string(runs.size()));
+        runWriter<T>(runs.back()).write(items.data(), n);
+    }
+    fclose(file);
+    remove(filename.c_str());
+    return runs;
+}
+
+// call f(item) for the records of all runs in increasing order
+template <class T, class F>
+void mergeRuns(const std::vector<std::string>& runs, F f) {
+    std::vector<std::unique_ptr<runReader<T>>> readers;
+    for (const auto& run : runs) {
+        readers.push_back(std::make_unique<runReader<T>>(run));
+    }
+    auto later = [&](int a, int b) { return readers[b]->peek() < readers[a]->peek(); };
+    std::priority_queue<int, std::vector<int>, decltype(later)> heap(later);
+    for (int i = 0; i < int(readers.size()); i++) {
+        if (!readers[i]->empty()) {
+            heap.push(i);
+        }
+    }
+    while (!heap.empty()) {
+        int i = heap.top();
+        heap.pop();
+        f(readers[i]->next());
+        if (!readers[i]->empty()) {
+            heap.push(i);
+        }
+    }
+}
@@ -0,0 +1,356 @@
+#include "main.hpp"
+#include "threadpool.hpp"
+#include "extsort.hpp"
+
+// Build the shape database by a breadth-first search from the seed shapes.
+// Every level expands the frontier by pin() and stackBase(stackShapes.code(mtd)) in parallel, then deduplicates
+// the children per shard. A shard holds the least rotations with the same top bits, so the shards are
+// sorted ranges and the database is written by concatenating them.
+// Seeds and separable shapes are expanded but not stored, the parser ends a method at them.
+// With a temporary directory the shards live in files instead, so only the sort buffers bound the memory.
+
+const int SHARD_BITS = 8;
+const u64 SHARDS = 1ull << SHARD_BITS;
+const u64 FRONTIER_GRAIN = 256; // parents per piece of work
+const u64 CHILD_BUFFER_ITEMS = 1024; // children buffered per worker and shard before they are written on disk
+
+inline u64 shardOf(u64 key) {
+    return key >> (CODE_SHIFT - SHARD_BITS);
+}
+
+typedef std::pair<u64, u64> dbItem; // (idx, value)
+
+struct shard {
+    std::vector<u64> visited;                // sorted least rotations
+    std::vector<dbItem> items;               // (idx, value) to store
+    std::vector<u64> next;                   // the new shapes of the level, sorted
+};
+
+// the seeds and separable shapes are not stored
+inline bool isStored(u64 key) {
+    return indexSeparableAxis(key) == -1;
+}
+
+// call f(key, value) for every child of the least rotation parent
+template <class F>
+void forEachChild(u64 parent, F f) {
+    // keys[mtd] for the stack shapes, then keys[MAX_MTD_MAIN] for pin, rotated together
+    u64 keys[MAX_MTD_MAIN + 1];
+    keys[MAX_MTD_MAIN] = indexPin(parent, MAX_HIGHT);
+    for (u64 mtd = 0; mtd < MAX_MTD_MAIN; mtd++) {
+        keys[mtd] = indexStackBase(parent, stackShapes.code(mtd), MAX_HIGHT);
+    }
+    leastRotationIndices(keys, keys, MAX_MTD_MAIN + 1);
+    auto emit = [&](u64 key, u64 mtd) {
+        if (key != 0 && key != parent) {
+            f(key, CreateValue(parent, mtd));
+        }
+    };
+    emit(keys[MAX_MTD_MAIN], PIN_CODE);
+    for (u64 mtd = 0; mtd < MAX_MTD_MAIN; mtd++) {
+        emit(keys[mtd], mtd);
+    }
+}
+
+// every non-empty single layer, or the shapes of seedFile, one per line as the parser reads them
+bool loadSeeds(const char* seedFile, std::vector<u64>& seeds) {
+    if (!seedFile) {
+        for (u64 code = 1; code < 0x100; code++) {
+            seeds.push_back(PackedShape(code, MAX_HIGHT).rotateToLeast().index());
+        }
+    } else {
+        std::ifstream file(seedFile);
+        if (!file.is_open()) {
+            std::cerr << "Error opening " << seedFile << " for reading." << std::endl;
+            return false;
+        }
+        std::string input;
+        while (file >> input) {
+            PackedShape shape;
+            if (input.size() > 2 && input[0] == '0' && input[1] == 'x') {
+                try {
+                    shape = PackedShape(std::stoull(input.substr(2), nullptr, 16) & MAX_INDEX, MAX_HIGHT);
+                } catch (const std::exception&) {
+                    std::cerr << "Invalid hex number: " << input << std::endl;
+                    return false;
+                }
+            } else {
+                shape = PackedShape(input, MAX_HIGHT);
+            }
+            if (!shape.isEmpty()) {
+                seeds.push_back(shape.rotateToLeast().index());
+            }
+        }
+    }
+    std::sort(seeds.begin(), seeds.end());
+    seeds.erase(std::unique(seeds.begin(), seeds.end()), seeds.end());
+    return true;
+}
+
+bool searchInMemory(const char* outFile, workStealingPool& pool, int maxLevels, std::vector<u64> frontier) {
+    std::vector<shard> shards(SHARDS);
+    for (u64 key : frontier) {
+        shards[shardOf(key)].visited.push_back(key);
+    }
+    // the children found by every worker, per shard
+    std::vector<std::vector<std::vector<dbItem>>> found(pool.size(), std::vector<std::vector<dbItem>>(SHARDS));
+    std::cerr << "Searching from " << frontier.size() << " seeds with " << pool.size() << " threads in memory." << std::endl;
+
+    auto start = std::chrono::steady_clock::now();
+    u64 totalChildren = 0;
+    for (int level = 1; !frontier.empty() && (maxLevels == 0 || level <= maxLevels); level++) {
+        auto levelStart = std::chrono::steady_clock::now();
+        pool.parallelFor(frontier.size(), FRONTIER_GRAIN, [&](u64 begin, u64 end, int worker) {
+            auto& out = found[worker];
+            for (u64 i = begin; i < end; i++) {
+                forEachChild(frontier[i], [&](u64 key, u64 value) {
+                    out[shardOf(key)].push_back({key, value});
+                });
+            }
+        });
+
+        u64 children = 0;
+        for (const auto& out : found) {
+            for (const auto& part : out) {
+                children += part.size();
+            }
+        }
+        // keep the least value of every new shape, so the database does not depend on the threads
+        pool.parallelFor(SHARDS, 1, [&](u64 begin, u64 end, int) {
+            std::vector<dbItem> all;
+            for (u64 s = begin; s < end; s++) {
+                auto& sh = shards[s];
+                all.clear();
+                for (auto& out : found) {
+                    all.insert(all.end(), out[s].begin(), out[s].end());
+                    out[s].clear();
+                }
+                std::sort(all.begin(), all.end());
+                sh.next.clear();
+                for (u64 i = 0; i < all.size(); i++) {
+                    auto [key, value] = all[i];
+                    if ((i > 0 && all[i-1].first == key) || std::binary_search(sh.visited.begin(), sh.visited.end(), key)) {
+                        continue;
+                    }
+                    sh.next.push_back(key);
+                    if (isStored(key)) {
+                        sh.items.push_back({key, value});
+                    }
+                }
+                u64 middle = sh.visited.size();
+                sh.visited.insert(sh.visited.end(), sh.next.begin(), sh.next.end());
+                std::inplace_merge(sh.visited.begin(), sh.visited.begin() + middle, sh.visited.end());
+            }
+        });
+
+        frontier.clear();
+        u64 stored = 0;
+        for (const auto& sh : shards) {
+            frontier.insert(frontier.end(), sh.next.begin(), sh.next.end());
+            stored += sh.items.size();
+        }
+        totalChildren += children;
+        std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - levelStart;
+        std::cerr << "Level " << level << ": " << children << " children, " << frontier.size() << " new, "
+                  << stored << " stored, " << u64(children / std::max(seconds.count(), 1e-9)) << " shapes/s." << std::endl;
+    }
+
+    u64 size = 0;
+    for (const auto& sh : shards) {
+        size += sh.items.size();
+    }
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+    std::cerr << "Found " << size << " shapes in " << getTimeStringHMS(seconds) << ", "
+              << u64(totalChildren / std::max(seconds.count(), 1e-9)) << " shapes/s." << std::endl;
+
+    // the items of a shard are sorted per level, the shards are in key order
+    pool.parallelFor(SHARDS, 1, [&](u64 begin, u64 end, int) {
+        for (u64 s = begin; s < end; s++) {
+            std::sort(shards[s].items.begin(), shards[s].items.end());
+        }
+    });
+    return saveDb(outFile, DB_FLAT, size, [&](auto f) {
+        for (const auto& sh : shards) {
+            for (const auto& [idx, value] : sh.items) {
+                f(idx, value);
+            }
+        }
+    });
+}
+
+bool searchOnDisk(const char* outFile, workStealingPool& pool, int maxLevels, const std::vector<u64>& seeds,
+                  const std::string& dir, u64 memory) {
+    auto shardFile = [&](u64 s, const std::string& kind) {
+        return dir + "/shard" + std::to_string(s) + "." + kind;
+    };
+    // the expansion buffers are taken first, the rest is shared by the sorts of the workers
+    u64 bufferBytes = pool.size() * SHARDS * CHILD_BUFFER_ITEMS * sizeof(dbItem);
+    u64 sortItems = std::max<u64>(memory > bufferBytes ? (memory - bufferBytes) / pool.size() / sizeof(dbItem) : 0, RUN_BUFFER_ITEMS);
+    {
+        std::vector<std::unique_ptr<runWriter<u64>>> visited(SHARDS), frontier(SHARDS);
+        for (u64 s = 0; s < SHARDS; s++) {
+            visited[s] = std::make_unique<runWriter<u64>>(shardFile(s, "visited"));
+            frontier[s] = std::make_unique<runWriter<u64>>(shardFile(s, "frontier"));
+        }
+        for (u64 key : seeds) {
+            visited[shardOf(key)]->push(key);
+            frontier[shardOf(key)]->push(key);
+        }
+    }
+    std::cerr << "Searching from " << seeds.size() << " seeds with " << pool.size() << " threads in " << dir
+              << ", sorting " << sortItems << " items per run." << std::endl;
+
+    auto start = std::chrono::steady_clock::now();
+    u64 totalChildren = 0;
+    u64 frontierSize = seeds.size();
+    int levels = 0;
+    std::vector<u64> stored(SHARDS, 0);
+    std::vector<u64> fresh(SHARDS, 0);
+    for (int level = 1; frontierSize > 0 && (maxLevels == 0 || level <= maxLevels); level++) {
+        auto levelStart = std::chrono::steady_clock::now();
+        std::vector<std::unique_ptr<runWriter<dbItem>>> children(SHARDS);
+        std::vector<std::mutex> childMutex(SHARDS);
+        for (u64 s = 0; s < SHARDS; s++) {
+            children[s] = std::make_unique<runWriter<dbItem>>(shardFile(s, "children"));
+        }
+        auto flush = [&](u64 s, std::vector<dbItem>& part) {
+            std::lock_guard<std::mutex> lock(childMutex[s]);
+            children[s]->write(part.data(), part.size());
+            part.clear();
+        };
+        std::vector<std::vector<std::vector<dbItem>>> found(pool.size(), std::vector<std::vector<dbItem>>(SHARDS));
+        pool.parallelFor(SHARDS, 1, [&](u64 begin, u64 end, int worker) {
+            auto& out = found[worker];
+            for (u64 s = begin; s < end; s++) {
+                runReader<u64> frontier(shardFile(s, "frontier"));
+                while (!frontier.empty()) {
+                    forEachChild(frontier.next(), [&](u64 key, u64 value) {
+                        auto& part = out[shardOf(key)];
+                        part.push_back({key, value});
+                        if (part.size() == CHILD_BUFFER_ITEMS) {
+                            flush(shardOf(key), part);
+                        }
+                    });
+                }
+            }
+        });
+        u64 childCount = 0;
+        for (u64 s = 0; s < SHARDS; s++) {
+            for (auto& out : found) {
+                if (!out[s].empty()) {
+                    flush(s, out[s]);
+                }
+            }
+            childCount += children[s]->count();
+            children[s]->close();
+        }
+
+        // sort the children of a shard into runs, then merge them with the visited shapes of the shard
+        // the least value of every new shape is kept, so the database does not depend on the threads
+        pool.parallelFor(SHARDS, 1, [&](u64 begin, u64 end, int) {
+            for (u64 s = begin; s < end; s++) {
+                auto runs = sortIntoRuns<dbItem>(shardFile(s, "children"), sortItems, shardFile(s, "run"));
+                runReader<u64> visited(shardFile(s, "visited"));
+                runWriter<u64> merged(shardFile(s, "merged"));
+                runWriter<u64> next(shardFile(s, "frontier"));
+                runWriter<dbItem> items(shardFile(s, "items" + std::to_string(level)));
+                bool first = true;
+                u64 last = 0;
+                mergeRuns<dbItem>(runs, [&](const dbItem& item) {
+                    u64 key = item.first;
+                    if (!first && key == last) {
+                        return;
+                    }
+                    first = false;
+                    last = key;
+                    while (!visited.empty() && visited.peek() < key) {
+                        merged.push(visited.next());
+                    }
+                    if (!visited.empty() && visited.peek() == key) {
+                        return;
+                    }
+                    merged.push(key);
+                    next.push(key);
+                    if (isStored(key)) {
+                        items.push(item);
+                    }
+                });
+                while (!visited.empty()) {
+                    merged.push(visited.next());
+                }
+                merged.close();
+                rename(shardFile(s, "merged").c_str(), shardFile(s, "visited").c_str());
+                for (const auto& run : runs) {
+                    remove(run.c_str());
+                }
+                fresh[s] = next.count();
+                stored[s] += items.count();
+            }
+        });
+
+        frontierSize = 0;
+        u64 storedSize = 0;
+        for (u64 s = 0; s < SHARDS; s++) {
+            frontierSize += fresh[s];
+            storedSize += stored[s];
+        }
+        levels = level;
+        totalChildren += childCount;
+        std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - levelStart;
+        std::cerr << "Level " << level << ": " << childCount << " children, " << frontierSize << " new, "
+                  << storedSize << " stored, " << u64(childCount / std::max(seconds.count(), 1e-9)) << " shapes/s." << std::endl;
+    }
+
+    u64 size = 0;
+    for (u64 s = 0; s < SHARDS; s++) {
+        size += stored[s];
+    }
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+    std::cerr << "Found " << size << " shapes in " << getTimeStringHMS(seconds) << ", "
+              << u64(totalChildren / std::max(seconds.count(), 1e-9)) << " shapes/s." << std::endl;
+
+    // the items of every level are a sorted run, the shards are in key order
+    bool saved = saveDb(outFile, DB_FLAT, size, [&](auto f) {
+        for (u64 s = 0; s < SHARDS; s++) {
+            std::vector<std::string> runs;
+            for (int level = 1; level <= levels; level++) {
+                runs.push_back(shardFile(s, "items" + std::to_string(level)));
+            }
+            mergeRuns<dbItem>(runs, [&](const dbItem& item) { f(item.first, item.second); });
+        }
+    });
+    for (u64 s = 0; s < SHARDS; s++) {
+        remove(shardFile(s, "visited").c_str());
+        remove(shardFile(s, "frontier").c_str());
+        for (int level = 1; level <= levels; level++) {
+            remove(shardFile(s, "items" + std::to_string(level)).c_str());
+        }
+    }
+    return saved;
+}
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <out_file> [threads] [max_levels] [seed_file] [tmp_dir] [memory_mb]" << std::endl;
+        std::cerr << "threads 0 uses all cores, max_levels 0 runs until no new shape is found, seed_file - uses the single layers" << std::endl;
+        std::cerr << "with tmp_dir the search keeps its shards in files there and uses about memory_mb (default 1024) of memory" << std::endl;
+        return 1;
+    }
+    int threads = argc > 2 ? std::stoi(argv[2]) : 0;
+    if (threads <= 0) {
+        threads = std::thread::hardware_concurrency();
+        if (threads <= 0) {
+            threads = THREADS;
+        }
+    }
+    int maxLevels = argc > 3 ? std::stoi(argv[3]) : 0;
+    std::vector<u64> seeds;
+    if (!loadSeeds(argc > 4 && std::string(argv[4]) != "-" ? argv[4] : nullptr, seeds)) {
+        return 1;
+    }
+    workStealingPool pool(threads);
+    if (argc > 5) {
+        u64 memory = (argc > 6 ? std::stoull(argv[6]) : 1024) << 20;
+        return searchOnDisk(argv[1], pool, maxLevels, seeds, argv[5], memory) ? 0 : 1;
+    }
+    return searchInMemory(argv[1], pool, maxLevels, seeds) ? 0 : 1;
+}
@@ -0,0 +1,162 @@
+#include "main.hpp"
+#include "query.hpp"
+
+#include <random>
+#include <sstream>
+
+// Replay a mix of queries through queryShape() as the parser answers them, once on a cold page cache and once
+// on a warm one, and report the latency percentiles of a query and the lookups per second.
+// The stored shapes are queried in a random rotation or mirror image, the others are random stable shapes,
+// most of which are not creatable or end early as the queries of a player do.
+
+// the database with the lookups of queryShape() counted
+class countingLookup {
+public:
+    explicit countingLookup(const shapeDb& db) : db(db) {}
+
+    bool find(u64 key, u64& value) const {
+        lookups++;
+        return db.find(key, value);
+    }
+    bool pending() const { return false; }
+    u64 size() const { return db.size(); }
+
+    mutable u64 lookups = 0;
+
+private:
+    const shapeDb& db;
+};
+
+// drop the pages of the file from the page cache, they must not be mapped or dirty
+void evictFile(const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    ::close(fd);
+}
+
+// the part of the file in the page cache, from 0 to 1
+double residentFraction(const char* filename) {
+    mappedFile file(filename);
+    if (file.size() == 0) {
+        return 0;
+    }
+    u64 pageSize = sysconf(_SC_PAGESIZE);
+    std::vector<unsigned char> pages((file.size() + pageSize - 1) / pageSize);
+    if (mincore(const_cast<char*>(file.data()), file.size(), pages.data()) != 0) {
+        return 0;
+    }
+    u64 resident = 0;
+    for (unsigned char page : pages) {
+        resident += page & 1;
+    }
+    return double(resident) / pages.size();
+}
+
+// queries shape strings, hitPercent of them stored shapes of db
+std::vector<std::string> queryMix(const shapeDb& db, u64 queries, int hitPercent, std::mt19937_64& rng) {
+    // stored shapes evenly spread over the database
+    std::vector<u64> stored;
+    u64 step = std::max<u64>(db.size() / TEST_POINTS, 1);
+    u64 i = 0;
+    db.forEach([&](u64 idx, u64) {
+        if (i++ % step == 0) {
+            stored.push_back(idx);
+        }
+    });
+    std::vector<std::string> mix;
+    for (u64 q = 0; q < queries; q++) {
+        if (!stored.empty() && int(rng() % 100) < hitPercent) {
+            PackedShape shape(Shape(stored[rng() % stored.size()], QUAD_SIZE, MAX_HIGHT));
+            if (rng() % 2) {
+                shape.mirror();
+            }
+            mix.push_back(shape.rotate(rng() % QUAD_SIZE).toString());
+        } else {
+            mix.push_back(randomShape(rng).toString());
+        }
+    }
+    return mix;
+}
+
+struct latencyResult {
+    u64 queries = 0;
+    u64 lookups = 0;
+    double seconds = 0;
+    std::vector<double> latencies; // ns, sorted
+
+    double percentile(double p) const {
+        if (latencies.empty()) {
+            return 0;
+        }
+        return latencies[std::min<u64>(latencies.size() - 1, u64(p * latencies.size()))];
+    }
+};
+
+latencyResult replay(const shapeDb& db, const std::vector<std::string>& queries) {
+    latencyResult result;
+    countingLookup lookup(db);
+    std::ostringstream answer;
+    result.latencies.reserve(queries.size());
+    for (const auto& input : queries) {
+        answer.str("");
+        auto start = std::chrono::steady_clock::now();
+        queryShape(input, lookup, answer);
+        std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+        result.latencies.push_back(seconds.count() * 1e9);
+        result.seconds += seconds.count();
+    }
+    std::sort(result.latencies.begin(), result.latencies.end());
+    result.queries = queries.size();
+    result.lookups = lookup.lookups;
+    return result;
+}
+
+void printResult(const char* name, const latencyResult& r, double resident) {
+    printf("%-6s %9.1f%% %10" PRIu64 " %12" PRIu64 " %10.2f %10.2f %10.2f %14.0f %14.0f\n", name, 100 * resident, r.queries,
+           r.lookups, r.percentile(0.5) / 1000, r.percentile(0.99) / 1000, r.percentile(1) / 1000,
+           r.queries / std::max(r.seconds, 1e-9), r.lookups / std::max(r.seconds, 1e-9));
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <shape_file> [queries] [hit_percent] [seed]" << std::endl;
+        std::cerr << "replays the queries on a cold and then a warm page cache, hit_percent of them stored shapes" << std::endl;
+        return 1;
+    }
+    const char* shapeFile = argv[1];
+    u64 queries = argc > 2 ? std::stoull(argv[2]) : TEST_POINTS;
+    int hitPercent = argc > 3 ? std::stoi(argv[3]) : 50;
+    std::mt19937_64 rng(argc > 4 ? std::stoull(argv[4]) : TEST_POINTS);
+
+    std::vector<std::string> mix;
+    {
+        const shapeDb db(shapeFile, false, MADV_SEQUENTIAL);
+        mix = queryMix(db, queries, hitPercent, rng);
+    }
+    // the lazy tables of the queries are built before the cold run, which only measures the database
+    Shape(mix.front(), MAX_HIGHT).separableAxis();
+    std::string radixFile = std::string(shapeFile) + RADIX_SUFFIX;
+    evictFile(shapeFile);
+    evictFile(radixFile.c_str());
+    double coldResident = residentFraction(shapeFile);
+
+    const shapeDb creatableShapes(shapeFile);
+    latencyResult cold = replay(creatableShapes, mix);
+    creatableShapes.advise(MADV_WILLNEED);
+    replay(creatableShapes, mix);
+    latencyResult warm = replay(creatableShapes, mix);
+    double warmResident = residentFraction(shapeFile);
+
+    printf("%-6s %10s %10s %12s %10s %10s %10s %14s %14s\n", "Cache", "Resident", "Queries", "Lookups",
+           "p50 (us)", "p99 (us)", "max (us)", "Queries/s", "Lookups/s");
+    printResult("cold", cold, coldResident);
+    printResult("warm", warm, warmResident);
+    if (coldResident > 0.01) {
+        std::cerr << "Warning: " << 100 * coldResident << "% of " << shapeFile << " stayed in the page cache, the cold run is partly warm." << std::endl;
+    }
+    return 0;
+}
@@ -1,7 +1,15 @@
 #pragma once
 
+// #define QUERY_STATS // count and time the stages of the queries, see stats.hpp
+
 #include "shape.hpp"
 #include "shape.cpp"
+#include "packedshape.hpp"
+#include "packedshape.cpp"
+#include "shapebatch.hpp"
+#include "mmapfilemap.hpp"
+#include "shapedb.hpp"
+#include "stats.hpp"
 
 #include <cassert>
 #include <vector>
@@ -17,8 +25,7 @@
 #include <cstdio>
 #include <fstream>
 #include <cinttypes>
-
-// #define OUTPUT_LOG
+#include <random>
 
 const int THREADS = 79;
 
@@ -48,113 +55,153 @@ inline u64 CreateValue(u64 idx, u64 mtd) {
 }
 
 const u64 MAX_MTD_MAIN = 9;
-const std::vector<Shape> stackShapes = {
-    Shape("CuCu----", MAX_HIGHT),
-    Shape("--CuCu--", MAX_HIGHT),
-    Shape("----CuCu", MAX_HIGHT),
-    Shape("Cu----Cu", MAX_HIGHT),
+constexpr const char* STACK_SHAPE_STRINGS[] = {
+    "CuCu----",
+    "--CuCu--",
+    "----CuCu",
+    "Cu----Cu",
 
-    Shape("CuCuCu--", MAX_HIGHT),
-    Shape("--CuCuCu", MAX_HIGHT),
-    Shape("Cu--CuCu", MAX_HIGHT),
-    Shape("CuCu--Cu", MAX_HIGHT),
+    "CuCuCu--",
+    "--CuCuCu",
+    "Cu--CuCu",
+    "CuCu--Cu",
 
-    Shape("CuCuCuCu", MAX_HIGHT),
+    "CuCuCuCu",
 
     // after do not used in main
-    Shape("Cu------", MAX_HIGHT),
-    Shape("--Cu----", MAX_HIGHT),
-    Shape("----Cu--", MAX_HIGHT),
-    Shape("------Cu", MAX_HIGHT),
+    "Cu------",
+    "--Cu----",
+    "----Cu--",
+    "------Cu",
 
-    Shape("P-------", MAX_HIGHT),
-    Shape("--P-----", MAX_HIGHT),
-    Shape("----P---", MAX_HIGHT),
-    Shape("------P-", MAX_HIGHT),
+    "P-------",
+    "--P-----",
+    "----P---",
+    "------P-",
 
     // after do not needed
-    Shape("Cu--Cu--", MAX_HIGHT),
-    Shape("--Cu--Cu", MAX_HIGHT),
-
-    Shape("CuP-----", MAX_HIGHT),
-    Shape("--CuP---", MAX_HIGHT),
-    Shape("----CuP-", MAX_HIGHT),
-    Shape("P-----Cu", MAX_HIGHT),
-
-    Shape("Cu--P---", MAX_HIGHT),
-    Shape("--Cu--P-", MAX_HIGHT),
-    Shape("P---Cu--", MAX_HIGHT),
-    Shape("--P---Cu", MAX_HIGHT),
-
-    Shape("Cu----P-", MAX_HIGHT),
-    Shape("P-Cu----", MAX_HIGHT),
-    Shape("--P-Cu--", MAX_HIGHT),
-    Shape("----P-Cu", MAX_HIGHT),
-
-    Shape("P-P-----", MAX_HIGHT),
-    Shape("--P-P---", MAX_HIGHT),
-    Shape("----P-P-", MAX_HIGHT),
-    Shape("P-----P-", MAX_HIGHT),
-
-    Shape("P---P---", MAX_HIGHT),
-    Shape("--P---P-", MAX_HIGHT),
-
-    Shape("CuCuP---", MAX_HIGHT),
-    Shape("--CuCuP-", MAX_HIGHT),
-    Shape("P---CuCu", MAX_HIGHT),
-    Shape("CuP---Cu", MAX_HIGHT),
-
-    Shape("CuCu--P-", MAX_HIGHT),
-    Shape("P-CuCu--", MAX_HIGHT),
-    Shape("--P-CuCu", MAX_HIGHT),
-    Shape("Cu--P-Cu", MAX_HIGHT),
-
-    Shape("CuP-Cu--", MAX_HIGHT),
-    Shape("--CuP-Cu", MAX_HIGHT),
-    Shape("Cu--CuP-", MAX_HIGHT),
-    Shape("P-Cu--Cu", MAX_HIGHT),
-
-    Shape("CuP-P---", MAX_HIGHT),
-    Shape("--CuP-P-", MAX_HIGHT),
-    Shape("P---CuP-", MAX_HIGHT),
-    Shape("P-P---Cu", MAX_HIGHT),
-
-    Shape("CuP---P-", MAX_HIGHT),
-    Shape("P-CuP---", MAX_HIGHT),
-    Shape("--P-CuP-", MAX_HIGHT),
-    Shape("P---P-Cu", MAX_HIGHT),
-
-    Shape("Cu--P-P-", MAX_HIGHT),
-    Shape("P-Cu--P-", MAX_HIGHT),
-    Shape("P-P-Cu--", MAX_HIGHT),
-    Shape("--P-P-Cu", MAX_HIGHT),
-
-    Shape("P-P-P---", MAX_HIGHT),
-    Shape("--P-P-P-", MAX_HIGHT),
-    Shape("P---P-P-", MAX_HIGHT),
-    Shape("P-P---P-", MAX_HIGHT),
-
-    Shape("CuCuCuP-", MAX_HIGHT),
-    Shape("P-CuCuCu", MAX_HIGHT),
-    Shape("CuP-CuCu", MAX_HIGHT),
-    Shape("CuCuP-Cu", MAX_HIGHT),
-
-    Shape("CuCuP-P-", MAX_HIGHT),
-    Shape("P-CuCuP-", MAX_HIGHT),
-    Shape("P-P-CuCu", MAX_HIGHT),
-    Shape("CuP-P-Cu", MAX_HIGHT),
-
-    Shape("CuP-CuP-", MAX_HIGHT),
-    Shape("P-CuP-Cu", MAX_HIGHT),
-
-    Shape("CuP-P-P-", MAX_HIGHT),
-    Shape("P-CuP-P-", MAX_HIGHT),
-    Shape("P-P-CuP-", MAX_HIGHT),
-    Shape("P-P-P-Cu", MAX_HIGHT),
-
-    Shape("P-P-P-P-", MAX_HIGHT)
+    "Cu--Cu--",
+    "--Cu--Cu",
+
+    "CuP-----",
+    "--CuP---",
+    "----CuP-",
+    "P-----Cu",
+
+    "Cu--P---",
+    "--Cu--P-",
+    "P---Cu--",
+    "--P---Cu",
+
+    "Cu----P-",
+    "P-Cu----",
+    "--P-Cu--",
+    "----P-Cu",
+
+    "P-P-----",
+    "--P-P---",
+    "----P-P-",
+    "P-----P-",
+
+    "P---P---",
+    "--P---P-",
+
+    "CuCuP---",
+    "--CuCuP-",
+    "P---CuCu",
+    "CuP---Cu",
+
+    "CuCu--P-",
+    "P-CuCu--",
+    "--P-CuCu",
+    "Cu--P-Cu",
+
+    "CuP-Cu--",
+    "--CuP-Cu",
+    "Cu--CuP-",
+    "P-Cu--Cu",
+
+    "CuP-P---",
+    "--CuP-P-",
+    "P---CuP-",
+    "P-P---Cu",
+
+    "CuP---P-",
+    "P-CuP---",
+    "--P-CuP-",
+    "P---P-Cu",
+
+    "Cu--P-P-",
+    "P-Cu--P-",
+    "P-P-Cu--",
+    "--P-P-Cu",
+
+    "P-P-P---",
+    "--P-P-P-",
+    "P---P-P-",
+    "P-P---P-",
+
+    "CuCuCuP-",
+    "P-CuCuCu",
+    "CuP-CuCu",
+    "CuCuP-Cu",
+
+    "CuCuP-P-",
+    "P-CuCuP-",
+    "P-P-CuCu",
+    "CuP-P-Cu",
+
+    "CuP-CuP-",
+    "P-CuP-Cu",
+
+    "CuP-P-P-",
+    "P-CuP-P-",
+    "P-P-CuP-",
+    "P-P-P-Cu",
+
+    "P-P-P-P-"
+};
+const int STACK_SHAPES = sizeof(STACK_SHAPE_STRINGS) / sizeof(STACK_SHAPE_STRINGS[0]);
+
+// the code of a one layer shape string of 4 quadrants, as Shape(str).index()
+constexpr u64 layerStringIndex(const char* str) {
+    u64 index = 0;
+    for (int j = 0; j < QUAD_SIZE; j++) {
+        char type = str[2*j];
+        index |= u64(type == '-' ? 0 : type == 'c' ? 1 : type == 'P' ? 2 : 3) << (2*j);
+    }
+    return index;
+}
+
+// every stack shape with its rotations and mirror images, and their strings as PackedShape::toString() prints them
+// [mirrored][times] is the stack shape mirrored first and then rotated times
+struct StackShapeTable {
+    u64 codes[STACK_SHAPES][2][QUAD_SIZE] = {};
+    char strings[STACK_SHAPES][2][QUAD_SIZE][2*QUAD_SIZE + 1] = {};
+
+    constexpr StackShapeTable() {
+        for (int mtd = 0; mtd < STACK_SHAPES; mtd++) {
+            u64 code = layerStringIndex(STACK_SHAPE_STRINGS[mtd]);
+            for (int mirrored = 0; mirrored < 2; mirrored++) {
+                for (int times = 0; times < QUAD_SIZE; times++) {
+                    u64 now = indexRotate(mirrored ? indexMirror(code) : code, times);
+                    codes[mtd][mirrored][times] = now;
+                    for (int j = 0; j < QUAD_SIZE; j++) {
+                        const char* item = "--cuP-Cu" + 2*((now >> (2*j)) & 0b11);
+                        strings[mtd][mirrored][times][2*j] = item[0];
+                        strings[mtd][mirrored][times][2*j + 1] = item[1];
+                    }
+                }
+            }
+        }
+    }
+
+    constexpr u64 code(u64 mtd, bool mirrored = false, int times = 0) const { return codes[mtd][mirrored][times]; }
+    constexpr const char* string(u64 mtd, bool mirrored = false, int times = 0) const { return strings[mtd][mirrored][times]; }
 };
 
+constexpr StackShapeTable stackShapes;
+
 inline std::string getTimeStringHMS(std::chrono::duration<double> duration) {
     auto hours = std::chrono::duration_cast<std::chrono::hours>(duration);
     duration -= hours;
@@ -164,6 +211,33 @@ inline std::string getTimeStringHMS(std::chrono::duration<double> duration) {
     return std::to_string(hours.count()) + "h " + std::to_string(minutes.count()) + "m " + std::to_string(seconds.count()) + "s";
 }
 
+// a shape of 1 to MAX_HIGHT layers with random items, fallen so it is stable as the shapes of a factory
+inline Shape randomShape(std::mt19937_64& rng) {
+    const char forms[] = "CRSW";
+    const char colors[] = "rgbcmywu";
+    while (true) {
+        Shape shape(QUAD_SIZE, 1 + rng() % MAX_HIGHT, MAX_HIGHT);
+        for (auto& layer : shape.shape) {
+            for (auto& item : layer) {
+                int kind = rng() % 20;
+                if (kind < 6) {
+                    item = Item('-', '-');
+                } else if (kind < 9) {
+                    item = Item('c', colors[rng() % 8]);
+                } else if (kind < 12) {
+                    item = Item('P', '-');
+                } else {
+                    item = Item(forms[rng() % 4], colors[rng() % 8]);
+                }
+            }
+        }
+        shape.fall().removeEmptyLayers();
+        if (!shape.isEmpty()) {
+            return shape;
+        }
+    }
+}
+
 inline bool saveMap(const char* outFile, const std::map<u64, u64> &m) {
     auto file = fopen(outFile, "w");
     if (!file) {
@@ -228,6 +302,7 @@ class fileMap {
     std::ifstream file;
     u64 size_;
     const u64 itemSize = 2*sizeof(u64); // 1 for index, 1 for method
+    std::unique_ptr<radixDirectory> directory; // the binary search stays in one bucket if there is a directory
 
     // Delete copy constructor and copy assignment operator
     fileMap(const fileMap&) = delete;
@@ -242,6 +317,7 @@ class fileMap {
         file.seekg(0, std::ios::end);
         size_ = file.tellg() / itemSize;
         std::cerr << "Loaded " << size_ << " items from " << filename << "." << std::endl;
+        directory = std::make_unique<radixDirectory>(filename, size_);
     }
     ~fileMap() {
         if (file.is_open()) {
@@ -256,11 +332,16 @@ class fileMap {
     }
 
     int count(u64 idx) {
+        STATS_TIME(LOOKUP);
+        STATS_COUNT(LOOKUPS, 1);
         if (cachedIndex == idx) {
             return 1; // Already cached
         }
         u64 left = 0;
         u64 right = size_;
+        if (!directory->range(idx, left, right)) {
+            return 0; // Not found
+        }
         for (;;) {
             if (left >= right) {
                 return 0; // Not found
@@ -268,14 +349,18 @@ class fileMap {
             u64 now = (left + right) / 2;
             file.seekg(now * itemSize, std::ios::beg);
             u64 index, value;
-            file.read(reinterpret_cast<char*>(&index), sizeof(index));
-            file.read(reinterpret_cast<char*>(&value), sizeof(value));
+            file.read(reinterpret_cast<char*>(&index), sizeof(index)); // the value is read only for the hit
+            STATS_COUNT(SEEKS, 1);
+            STATS_COUNT(BYTES_READ, sizeof(index));
 
             if (index < idx) {
                 left = now + 1;
             } else if (index > idx) {
                 right = now;
             } else {
+                file.read(reinterpret_cast<char*>(&value), sizeof(value));
+                STATS_COUNT(BYTES_READ, sizeof(value));
+                STATS_COUNT(LOOKUP_HITS, 1);
                 cachedIndex = index;
                 cachedValue = value;
                 return 1;
@@ -284,11 +369,16 @@ class fileMap {
     }
 
     u64 operator[](u64 idx) {
+        STATS_TIME(LOOKUP);
+        STATS_COUNT(LOOKUPS, 1);
         if (cachedIndex == idx) {
             return cachedValue; // Already cached
         }
         u64 left = 0;
         u64 right = size_;
+        if (!directory->range(idx, left, right)) {
+            return 0; // Not found
+        }
         for (;;) {
             if (left >= right) {
                 return 0; // Not found
@@ -296,14 +386,18 @@ class fileMap {
             u64 now = (left + right) / 2;
             file.seekg(now * itemSize, std::ios::beg);
             u64 index, value;
-            file.read(reinterpret_cast<char*>(&index), sizeof(index));
-            file.read(reinterpret_cast<char*>(&value), sizeof(value));
+            file.read(reinterpret_cast<char*>(&index), sizeof(index)); // the value is read only for the hit
+            STATS_COUNT(SEEKS, 1);
+            STATS_COUNT(BYTES_READ, sizeof(index));
 
             if (index < idx) {
                 left = now + 1;
             } else if (index > idx) {
                 right = now;
             } else {
+                file.read(reinterpret_cast<char*>(&value), sizeof(value));
+                STATS_COUNT(BYTES_READ, sizeof(value));
+                STATS_COUNT(LOOKUP_HITS, 1);
                 cachedIndex = index;
                 cachedValue = value;
                 return value;
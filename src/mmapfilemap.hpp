@@ -0,0 +1,71 @@
+#pragma once
+
+#include "shape.hpp"
+
+#include <iostream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// a read-only memory map of a whole file
+class mappedFile {
+public:
+    // populate: read the whole file in while mapping (MAP_POPULATE)
+    // advice: the madvise() hint for the accesses
+    mappedFile(const char* filename, bool populate = false, int advice = MADV_NORMAL) {
+        int fd = open(filename, O_RDONLY);
+        if (fd < 0) {
+            std::cerr << "Error opening file: " << filename << std::endl;
+            throw std::runtime_error("File open error");
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            std::cerr << "Error reading size of file: " << filename << std::endl;
+            throw std::runtime_error("File stat error");
+        }
+        bytes_ = st.st_size;
+        if (bytes_ > 0) {
+            void* addr = mmap(nullptr, bytes_, PROT_READ, MAP_SHARED | (populate ? MAP_POPULATE : 0), fd, 0);
+            if (addr == MAP_FAILED) {
+                ::close(fd);
+                std::cerr << "Error mapping file: " << filename << std::endl;
+                throw std::runtime_error("File map error");
+            }
+            data_ = static_cast<const char*>(addr);
+            madvise(addr, bytes_, advice);
+        }
+        ::close(fd);
+    }
+    ~mappedFile() {
+        close();
+    }
+
+    // Delete copy constructor and copy assignment operator
+    mappedFile(const mappedFile&) = delete;
+    mappedFile& operator=(const mappedFile&) = delete;
+
+    void close() {
+        if (data_) {
+            munmap(const_cast<char*>(data_), bytes_);
+            data_ = nullptr;
+            bytes_ = 0;
+        }
+    }
+
+    // hint the kernel about the next accesses, e.g. MADV_WILLNEED before a batch
+    void advise(int advice) const {
+        if (data_) {
+            madvise(const_cast<char*>(data_), bytes_, advice);
+        }
+    }
+
+    const char* data() const { return data_; }
+    size_t size() const { return bytes_; }
+
+private:
+    const char* data_ = nullptr;
+    size_t bytes_ = 0;
+};
@@ -0,0 +1,378 @@
+#include "packedshape.hpp"
+
+// the paint of a cell is colour | form<<3, the index 0 is the default Cu / cu of Shape(u64)
+const std::string PACKED_COLORS = "urgbcmyw";
+const std::string PACKED_FORMS = "CRSWHFG";
+
+static u64 paintIndex(const std::string& names, char c) {
+    auto pos = names.find(c);
+    return pos == std::string::npos ? 0 : pos;
+}
+
+PackedShape::PackedShape(const Shape& shape) : maxHight(shape.maxHight) {
+    int hight = std::min<int>(shape.shape.size(), PACKED_LAYERS);
+    for (int i = 0; i < hight; i++) {
+        for (int j = 0; j < PACKED_WIDTH; j++) {
+            setItem(i, j, shape.shape[i][j]);
+        }
+    }
+}
+
+Shape PackedShape::toShape() const {
+    int hight = this->hight();
+    Shape shape(PACKED_WIDTH, hight, maxHight);
+    for (int i = 0; i < hight; i++) {
+        for (int j = 0; j < PACKED_WIDTH; j++) {
+            shape.shape[i][j] = getItem(i, j);
+        }
+    }
+    return shape;
+}
+
+std::string PackedShape::toString() const {
+    std::string result;
+    int hight = this->hight();
+    for (int i = 0; i < hight; i++) {
+        for (int j = 0; j < PACKED_WIDTH; j++) {
+            result += getItem(i, j).toString();
+        }
+        result += ':';
+    }
+    if (!result.empty()) {
+        result.pop_back(); // Remove the last colon
+    }
+    return result;
+}
+
+// do not check if the position is valid
+Item PackedShape::getItem(int x, int y) const {
+    int shift = 2 * (x * PACKED_WIDTH + y);
+    u64 paintNow = 0;
+    for (int k = 0; k < 3; k++) {
+        paintNow |= ((paint[k] >> shift) & 0b11) << (2*k);
+    }
+    switch ((code >> shift) & 0b11) {
+    case 0:
+        return Item('-', '-');
+    case 1:
+        return Item('c', PACKED_COLORS[paintNow & 0b111]);
+    case 2:
+        return Item('P', '-');
+    default:
+        return Item(PACKED_FORMS[(paintNow >> 3) % PACKED_FORMS.size()], PACKED_COLORS[paintNow & 0b111]);
+    }
+}
+
+// do not check if the position is valid
+PackedShape& PackedShape::setItem(int x, int y, const Item& item) {
+    int shift = 2 * (x * PACKED_WIDTH + y);
+    u64 type = 0;
+    u64 paintNow = 0;
+    switch (item.type) {
+    case '-':
+        type = 0;
+        break;
+    case 'c':
+        type = 1;
+        paintNow = paintIndex(PACKED_COLORS, item.color);
+        break;
+    case 'P':
+        type = 2;
+        break;
+    default: // 'C' or any other type
+        type = 3;
+        paintNow = paintIndex(PACKED_COLORS, item.color) | (paintIndex(PACKED_FORMS, item.type) << 3);
+        break;
+    }
+    code = (code & ~(0b11ull << shift)) | (type << shift);
+    for (int k = 0; k < 3; k++) {
+        paint[k] = (paint[k] & ~(0b11ull << shift)) | (((paintNow >> (2*k)) & 0b11) << shift);
+    }
+    return *this;
+}
+
+// this method will change all entity to Cu, all cry to cu
+PackedShape& PackedShape::rotateToLeast() {
+    code = indexLeastRotation(code);
+    paint[0] = paint[1] = paint[2] = 0;
+    return *this;
+}
+
+// every rule is symmetric under mirroring, so a shape and its mirror image share one canonical shape
+PackedShape& PackedShape::toCanonical() {
+    code = indexCanonical(code);
+    paint[0] = paint[1] = paint[2] = 0;
+    return *this;
+}
+
+// return true if all quadrants of the shape is creatable, as Shape::isAllQuadrantCreatable()
+bool PackedShape::isAllQuadrantCreatable(int totalWidth, bool onlyUseWeekFall) const {
+    bool more6Quad = totalWidth >= 6;
+    if (hight() <= QUAD_TABLE_HIGHT) {
+        return isAllQuadrantIndexCreatable(code, more6Quad, onlyUseWeekFall);
+    }
+    for (int y = 0; y < PACKED_WIDTH; y++) {
+        if (!isQuadrantIndexCreatable(getQuadrantIndex(y), more6Quad, onlyUseWeekFall)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void PackedShape::clearCells(u64 cells) {
+    u64 lanes = cellsToLanes(cells);
+    code &= ~lanes;
+    for (auto& word : paint) {
+        word &= ~lanes;
+    }
+}
+
+// move the cells down by layers, the cells must be above the layers they fall to
+void PackedShape::moveCells(u64 cells, int layers) {
+    u64 lanes = cellsToLanes(cells);
+    int shift = 8 * layers;
+    code = (code & ~lanes) | ((code & lanes) >> shift);
+    for (auto& word : paint) {
+        word = (word & ~lanes) | ((word & lanes) >> shift);
+    }
+}
+
+// copy the quadrants of fromLayer in from to toLayer in this shape
+void PackedShape::placeCells(const PackedShape& from, u64 quads, int fromLayer, int toLayer) {
+    if (toLayer >= PACKED_LAYERS) {
+        return;
+    }
+    u64 lanes = cellsToLanes(quads);
+    int fromShift = 8 * fromLayer;
+    int toShift = 8 * toLayer;
+    code |= ((from.code >> fromShift) & lanes) << toShift;
+    for (int k = 0; k < 3; k++) {
+        paint[k] |= ((from.paint[k] >> fromShift) & lanes) << toShift;
+    }
+}
+
+// the fall of Shape::fall() on the cells
+// unstable cry are broken, then the unstable blocks fall from down to up until they touch an item
+// the layers from base are not in this shape, their items are copied from upper
+void PackedShape::dropCells(u64 cry, u64 pin, u64 ent, const PackedShape* upper, int base) {
+    u64 stable = ::stableCells(cry, pin, ent);
+    clearCells(cry & ~stable);
+    cry &= stable;
+
+    forEachFallingBlock(cry, pin, ent, (pin | ent) & ~stable, [&](u64 block, int layer, int fallTo) {
+        if (layer < base) {
+            moveCells(block, layer - fallTo);
+        } else {
+            placeCells(*upper, cellsDown(block, layer) & 0xF, layer - base, fallTo);
+        }
+    });
+    if (upper) {
+        for (int layer = base; layer < PACKED_LAYERS; layer++) {
+            placeCells(*upper, cellsDown(stable, layer) & 0xF, layer - base, layer);
+        }
+    }
+}
+
+// do not check if the position is valid
+// break c will also break the cblock
+PackedShape& PackedShape::breakItem(int x, int y) {
+    return breakItems(1ull << (x * PACKED_WIDTH + y));
+}
+
+PackedShape& PackedShape::breakLayer(int x) {
+    return breakItems(layerCells(x));
+}
+
+PackedShape& PackedShape::breakQuadrant(int y) {
+    y = (y % PACKED_WIDTH + PACKED_WIDTH) % PACKED_WIDTH;
+    return breakItems(quadrantCells(y));
+}
+
+// break c will also break the cblock
+PackedShape& PackedShape::breakItems(u64 cells) {
+    u64 broken = cells & filledCells();
+    broken |= findCrystalCells(broken, crystalCells());
+    clearCells(broken);
+    return *this;
+}
+
+PackedShape& PackedShape::cutHight(int maxHight, bool useFall) {
+    if (maxHight <= 0 || isEmpty()) {
+        return *this;
+    }
+    breakItems(~lowerCells(maxHight));
+    if (useFall) {
+        fall();
+    }
+    return *this;
+}
+
+// change every empty item in this to the item in other
+PackedShape& PackedShape::combine(const PackedShape& other) {
+    if (isEmpty() || other.isEmpty()) {
+        return *this;
+    }
+    u64 lanes = cellsToLanes(other.filledCells() & ~filledCells());
+    code |= other.code & lanes;
+    for (int k = 0; k < 3; k++) {
+        paint[k] |= other.paint[k] & lanes;
+    }
+    return *this;
+}
+
+PackedShape& PackedShape::fall() {
+    if (isEmpty()) {
+        return *this;
+    }
+    dropCells(crystalCells(), pinCells(), entityCells(), nullptr, CELL_LAYERS);
+    return *this;
+}
+
+PackedShape& PackedShape::rotate(int times) {
+    code = indexRotate(code, times);
+    for (auto& word : paint) {
+        word = indexRotate(word, times);
+    }
+    return *this;
+}
+
+PackedShape& PackedShape::mirror() {
+    code = indexMirror(code);
+    for (auto& word : paint) {
+        word = indexMirror(word);
+    }
+    return *this;
+}
+
+PackedShape& PackedShape::cry(char color) {
+    if (isEmpty()) {
+        return *this;
+    }
+    u64 lanes = cellsToLanes(lowerCells(hight()) & ~(crystalCells() | entityCells()));
+    u64 paintNow = paintIndex(PACKED_COLORS, color);
+    code = (code & ~lanes) | (lanes & EVEN_LANES);
+    for (int k = 0; k < 3; k++) {
+        paint[k] = (paint[k] & ~lanes) | (lanes & (EVEN_LANES * ((paintNow >> (2*k)) & 0b11)));
+    }
+    return *this;
+}
+
+PackedShape& PackedShape::pin() {
+    if (isEmpty()) {
+        return *this;
+    }
+    u64 ground = filledCells() & layerCells(0);
+    // the layers pushed out of the limit are broken before moving up
+    if (maxHight > 0) {
+        breakItems(~lowerCells(limit() - 1));
+    }
+    code <<= 8;
+    for (auto& word : paint) {
+        word <<= 8;
+    }
+    code |= cellsToLanes(ground) & ~EVEN_LANES;
+    if (maxHight > 0) {
+        fall();
+    }
+    return *this;
+}
+
+PackedShape& PackedShape::stack(const PackedShape& other) {
+    if (isEmpty() || other.isEmpty()) {
+        return *this;
+    }
+    int hight = this->hight();
+    PackedShape upper = other;
+    upper.clearCells(upper.crystalCells());
+    dropCells(crystalCells(), pinCells() | cellsUp(upper.pinCells(), hight), entityCells() | cellsUp(upper.entityCells(), hight), &upper, hight);
+    return cutHight(maxHight, false);
+}
+
+// do not check if the other is valid
+// do not fall the shape
+// other should not have c
+PackedShape& PackedShape::stackBase(const PackedShape& other) {
+    if (isEmpty() || other.isEmpty()) {
+        return *this;
+    }
+    forEachStackedBlock(filledCells(), hight(), other.code, [&](u64 quads, int layer, int fallTo) {
+        placeCells(other, quads, layer, fallTo);
+    });
+    return cutHight(maxHight, false);
+}
+
+PackedShape& PackedShape::halfBreak(int axis) {
+    if (isEmpty()) {
+        return *this;
+    }
+    for (int j = axis - PACKED_WIDTH/2; j < axis; j++) {
+        breakQuadrant(j);
+    }
+    return fall();
+}
+
+PackedShape PackedShape::cut(int axis) {
+    if (isEmpty()) {
+        return *this;
+    }
+    auto cutShape = *this;
+    cutShape.halfBreak(axis + PACKED_WIDTH/2);
+
+    halfBreak(axis);
+    return cutShape;
+}
+
+PackedShape& PackedShape::exchange(PackedShape& other, int axis) {
+    if (isEmpty() || other.isEmpty()) {
+        return *this;
+    }
+    auto toOther = cut(axis);
+    auto toThis = other.cut(axis);
+
+    combine(toThis);
+    other.combine(toOther);
+    return *this;
+}
+
+u64 indexBreakItems(u64 index, u64 cells) {
+    u64 broken = cells & codeFilledCells(index);
+    broken |= findCrystalCells(broken, codeCrystalCells(index));
+    return index & ~cellsToLanes(broken);
+}
+
+u64 indexFall(u64 index) {
+    u64 cry = codeCrystalCells(index);
+    u64 pin = codePinCells(index);
+    u64 ent = codeEntityCells(index);
+    u64 stable = ::stableCells(cry, pin, ent);
+    index &= ~cellsToLanes(cry & ~stable);
+    forEachFallingBlock(cry & stable, pin, ent, (pin | ent) & ~stable, [&](u64 block, int layer, int fallTo) {
+        u64 lanes = cellsToLanes(block);
+        index = (index & ~lanes) | ((index & lanes) >> (8 * (layer - fallTo)));
+    });
+    return index;
+}
+
+u64 indexPin(u64 index, int maxHight) {
+    if (index == 0) {
+        return index;
+    }
+    u64 ground = codeFilledCells(index) & layerCells(0);
+    if (maxHight > 0) {
+        index = indexBreakItems(index, ~lowerCells(std::min(maxHight, PACKED_LAYERS) - 1));
+    }
+    index = (index << 8) | (cellsToLanes(ground) & ~EVEN_LANES);
+    return maxHight > 0 ? indexFall(index) : index;
+}
+
+u64 indexStackBase(u64 index, u64 other, int maxHight) {
+    if (index == 0 || other == 0) {
+        return index;
+    }
+    forEachStackedBlock(codeFilledCells(index), (63 - std::countl_zero(index)) / 8 + 1, other, [&](u64 quads, int layer, int fallTo) {
+        if (fallTo < PACKED_LAYERS) {
+            index |= ((other >> (8 * layer)) & cellsToLanes(quads)) << (8 * fallTo);
+        }
+    });
+    return maxHight > 0 ? indexBreakItems(index, ~lowerCells(maxHight)) : index;
+}
@@ -0,0 +1,206 @@
+#pragma once
+
+#include "shape.hpp"
+
+#include <bit>
+
+// A cell mask has one bit per cell, bit (layer*4 + quadrant), so a u64 covers 16 layers.
+// Codes use 2 bits per cell and one byte per layer, the same as Shape::index().
+
+const int PACKED_WIDTH = 4;
+const int PACKED_LAYERS = 8; // layers that fit in a u64 code
+const int CELL_LAYERS = 16;  // layers that fit in a u64 cell mask
+
+const u64 QUAD_CELLS = 0x1111111111111111; // the cells of quadrant 0 in every layer
+const u64 EVEN_LANES = 0x5555555555555555; // the low bit of every 2-bit lane
+
+inline u64 layerCells(int layer) {
+    return 0xFull << (4*layer);
+}
+// the cells of the layers below layer
+inline u64 lowerCells(int layer) {
+    return layer >= CELL_LAYERS ? ~0ull : (1ull << (4*layer)) - 1;
+}
+inline u64 quadrantCells(int y) {
+    return QUAD_CELLS << y;
+}
+inline u64 cellsUp(u64 cells, int layers = 1) {
+    return layers >= CELL_LAYERS ? 0 : cells << (4*layers);
+}
+inline u64 cellsDown(u64 cells, int layers = 1) {
+    return layers >= CELL_LAYERS ? 0 : cells >> (4*layers);
+}
+// move every cell to quadrant (y+times)%4, as Shape::rotate()
+inline u64 rotateCells(u64 cells, int times = 1) {
+    times &= 3;
+    if (times == 0) {
+        return cells;
+    }
+    const u64 keep = QUAD_CELLS * ((0xFull << times) & 0xF);
+    return ((cells << times) & keep) | ((cells >> (4-times)) & ~keep);
+}
+
+// spread the low 32 cells to 2-bit lanes, both bits of a lane set
+inline u64 cellsToLanes(u64 cells) {
+    u64 x = cells & 0xFFFFFFFF;
+    x = (x | (x << 16)) & 0x0000FFFF0000FFFF;
+    x = (x | (x << 8))  & 0x00FF00FF00FF00FF;
+    x = (x | (x << 4))  & 0x0F0F0F0F0F0F0F0F;
+    x = (x | (x << 2))  & 0x3333333333333333;
+    x = (x | (x << 1))  & EVEN_LANES;
+    return x | (x << 1);
+}
+// collect the low bit of every 2-bit lane into a cell mask
+inline u64 lanesToCells(u64 lanes) {
+    u64 x = lanes & EVEN_LANES;
+    x = (x | (x >> 1))  & 0x3333333333333333;
+    x = (x | (x >> 2))  & 0x0F0F0F0F0F0F0F0F;
+    x = (x | (x >> 4))  & 0x00FF00FF00FF00FF;
+    x = (x | (x >> 8))  & 0x0000FFFF0000FFFF;
+    x = (x | (x >> 16)) & 0x00000000FFFFFFFF;
+    return x;
+}
+
+inline u64 codeCrystalCells(u64 code) { return lanesToCells(code & ~(code >> 1)); }
+inline u64 codePinCells(u64 code)     { return lanesToCells(~code & (code >> 1)); }
+inline u64 codeEntityCells(u64 code)  { return lanesToCells(code & (code >> 1)); }
+inline u64 codeFilledCells(u64 code)  { return lanesToCells(code | (code >> 1)); }
+
+constexpr cellGrid PACKED_GRID(PACKED_WIDTH);
+
+// the block of items that contains the seed cells, as Shape::findblock()
+inline u64 findBlockCells(u64 seed, u64 cry, u64 ent) {
+    return PACKED_GRID.findBlock(seed, cry, ent);
+}
+// the blocks of cry that contain the seed cells, as Shape::findcblock()
+inline u64 findCrystalCells(u64 seed, u64 cry) {
+    return PACKED_GRID.findCrystal(seed, cry);
+}
+// the stable items of the shape, circles are stable as Shape::isStableAll()
+inline u64 stableCells(u64 cry, u64 pin, u64 ent) {
+    return PACKED_GRID.stable(cry, pin, ent);
+}
+
+// the unstable blocks of Shape::fall() from down to up, the unstable cry must be broken before
+// falling is the unstable pin and entity cells, f(block, layer, fallTo) moves the block from layer to fallTo
+template <class F>
+void forEachFallingBlock(u64 cry, u64 pin, u64 ent, u64 falling, F f) {
+    for (int layer = 1; falling != 0 && layer < CELL_LAYERS; layer++) {
+        for (u64 rest = falling & layerCells(layer); rest != 0; ) {
+            u64 block = findBlockCells(rest & -rest, cry, ent);
+            u64 quads = cellsDown(block, layer) & 0xF;
+            u64 filled = cry | pin | ent;
+            int fallTo = layer - 1;
+            while (fallTo > 0 && (cellsDown(filled, fallTo-1) & quads) == 0) {
+                fallTo--;
+            }
+            int layers = layer - fallTo;
+            pin = (pin & ~block) | cellsDown(pin & block, layers);
+            ent = (ent & ~block) | cellsDown(ent & block, layers);
+            f(block, layer, fallTo);
+            rest &= ~block;
+            falling &= ~block;
+        }
+    }
+}
+
+// the blocks of other in Shape::stackBase() on a shape of filled cells and hight layers, from down to up
+// f(quads, layer, fallTo) places the quadrants quads of layer in other to fallTo
+template <class F>
+void forEachStackedBlock(u64 filled, int hight, u64 other, F f) {
+    u64 otherFilled = codeFilledCells(other);
+    u64 otherCry = codeCrystalCells(other);
+    u64 otherEnt = codeEntityCells(other);
+    for (int j = 0; otherFilled & ~lowerCells(j); j++) {
+        int layer = hight + 1 + j;
+        for (u64 rest = otherFilled & layerCells(j); rest != 0; ) {
+            u64 block = findBlockCells(rest & -rest, otherCry & layerCells(j), otherEnt & layerCells(j));
+            u64 quads = cellsDown(block, j) & 0xF;
+            int fallTo = layer - 1;
+            while (fallTo > 0 && (cellsDown(filled, fallTo-1) & quads) == 0) {
+                fallTo--;
+            }
+            filled |= cellsUp(quads, fallTo);
+            f(quads, j, fallTo);
+            rest &= ~block;
+        }
+    }
+}
+
+// PackedShape::breakItems(), fall(), pin() and stackBase() on the code alone,
+// the same code as PackedShape without the paint, maxHight 0 is infinite
+u64 indexBreakItems(u64 index, u64 cells);
+u64 indexFall(u64 index);
+u64 indexPin(u64 index, int maxHight = 0);
+u64 indexStackBase(u64 index, u64 other, int maxHight = 0);
+
+// a width 4 shape packed in words, layers are from down to up, quadrants are clockwise
+// code: 2 bits per cell, one byte per layer, the same as Shape::index()
+// paint: the colour and form of every cell, 6 bits per cell split into 2-bit lanes of 3 words
+// empty top layers are never stored, a shape holds at most PACKED_LAYERS layers
+class PackedShape {
+public:
+    u64 code = 0;
+    u64 paint[3] = {0, 0, 0};
+    int maxHight = 0; // 0 if infinite, limited to PACKED_LAYERS
+
+    PackedShape() = default;
+    PackedShape(u64 code, int maxHight = 0) : code(code), maxHight(maxHight) {}
+    PackedShape(const Shape& shape); // the shape must have 4 quadrants
+    PackedShape(std::string str, int maxHight = 0) : PackedShape(Shape(str, maxHight)) {}
+
+    bool operator==(const PackedShape& other) const {
+        return code == other.code && paint[0] == other.paint[0] && paint[1] == other.paint[1] && paint[2] == other.paint[2];
+    }
+    bool operator!=(const PackedShape& other) const { return !(*this == other); }
+    bool isEmpty() const { return code == 0; }
+
+    PackedShape copy() const { return *this; }
+    Shape toShape() const;
+
+    std::string toString() const;
+    friend std::ostream& operator<<(std::ostream& os, const PackedShape& shape) { return os << shape.toString(); }
+    u64 index() const { return code; }
+    int hight() const { return code == 0 ? 0 : (63 - std::countl_zero(code)) / 8 + 1; }
+    Item getItem(int x, int y) const;
+    PackedShape& setItem(int x, int y, const Item& item);
+    PackedShape& rotateToLeast();
+    PackedShape& toCanonical(); // the least of rotateToLeast() over the shape and its mirror image
+
+    u64 getQuadrantIndex(int y) const { return indexQuadrant(code, y); }
+    bool isAllQuadrantCreatable(int totalWidth = 0, bool onlyUseWeekFall = false) const;
+
+    u64 crystalCells() const { return codeCrystalCells(code); }
+    u64 pinCells() const { return codePinCells(code); }
+    u64 entityCells() const { return codeEntityCells(code); }
+    u64 filledCells() const { return codeFilledCells(code); }
+    u64 stableCells() const { return ::stableCells(crystalCells(), pinCells(), entityCells()); }
+    bool isStable() const { return stableCells() == filledCells(); }
+
+    PackedShape& breakItem(int x, int y);
+    PackedShape& breakLayer(int x);
+    PackedShape& breakQuadrant(int y);
+    PackedShape& breakItems(u64 cells);
+
+    PackedShape& cutHight(int maxHight, bool useFall = true);
+    PackedShape& combine(const PackedShape& other); // change - in this shape to the item in other
+    PackedShape& fall();
+
+    PackedShape& rotate(int times = 1);
+    PackedShape& mirror(); // quadrant y goes to quadrant 3-y
+    PackedShape& cry(char color);
+    PackedShape& pin();
+    PackedShape& stack(const PackedShape& other);
+    PackedShape& stackBase(const PackedShape& other);
+    // the axis is between quadrant axis and axis-1
+    PackedShape& halfBreak(int axis = 0);
+    PackedShape cut(int axis = 0);
+    PackedShape& exchange(PackedShape& other, int axis = 0);
+
+private:
+    int limit() const { return maxHight > 0 && maxHight < PACKED_LAYERS ? maxHight : PACKED_LAYERS; }
+    void clearCells(u64 cells);
+    void moveCells(u64 cells, int layers);
+    void placeCells(const PackedShape& from, u64 cells, int fromLayer, int toLayer);
+    void dropCells(u64 cry, u64 pin, u64 ent, const PackedShape* upper, int base);
+};
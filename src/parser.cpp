@@ -1,99 +1,162 @@
 #include "main.hpp"
+#include "query.hpp"
+#include "threadpool.hpp"
+#include "asynclookup.hpp"
 
-int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " <shape_file>" << std::endl;
-        return 1;
-    }
-    auto shapeFile = argv[1];
-    auto creatableShapes = fileMap(shapeFile);
+#include <sstream>
 
-    for (;;) {
-        std::string input;
-        std::cout << "Enter a shape to parse (or 'exit' to quit): " << std::endl;
-        std::cin >> input;
-        if (input == "exit") break;
+const u64 BATCH_SIZE = 1 << 16; // shapes read, answered and written together
+const u64 JOIN_BATCH_SIZE = 1 << 20; // the join reads the database once per round, so it takes larger batches
+const u64 BATCH_GRAIN = 64;
 
-        Shape shape(0,0, MAX_HIGHT);
-        if (input[0] == '0' && input[1] == 'x') {
-            // If input is a hex number, convert it to u64
-            u64 value;
-            try {
-                value = std::stoull(input.substr(2), nullptr, 16);
-            } catch (const std::invalid_argument&) {
-                std::cerr << "Invalid hex number." << std::endl;
-                continue;
+// answer the shapes by rounds of sorted lookups instead of a binary search per lookup
+// every round answers all unfinished shapes from the keys known so far, then joins the keys
+// they missed against the database (a shapeDb or an asyncLookup), a method of n steps is known after n+1 rounds
+template <class Db>
+void answerByJoin(Db& creatableShapes, const std::vector<std::string>& inputs, std::vector<std::string>& answers,
+                  workStealingPool& pool) {
+    std::unordered_map<u64, u64> known;
+    std::vector<u64> pending(inputs.size());
+    for (u64 i = 0; i < inputs.size(); i++) {
+        pending[i] = i;
+    }
+    std::vector<std::vector<u64>> missing(inputs.size());
+    std::vector<u64> keys;
+    while (!pending.empty()) {
+        pool.parallelFor(pending.size(), BATCH_GRAIN, [&](u64 begin, u64 end, int) {
+            std::ostringstream answer;
+            for (u64 p = begin; p < end; p++) {
+                u64 i = pending[p];
+                knownLookup lookup(known, creatableShapes.size());
+                answer.str("");
+                if (!queryShape(inputs[i], lookup, answer)) {
+                    answer << "Invalid hex number." << std::endl;
+                }
+                missing[i] = std::move(lookup.missing);
+                if (missing[i].empty()) {
+                    answers[i] = answer.str();
+                }
+            }
+        });
+        keys.clear();
+        u64 left = 0;
+        for (u64 i : pending) {
+            if (!missing[i].empty()) {
+                keys.insert(keys.end(), missing[i].begin(), missing[i].end());
+                pending[left++] = i;
             }
-            shape = Shape(value, QUAD_SIZE, MAX_HIGHT);
-            std::cout << "Shape created from hex: " << shape << std::endl;
-        } else {
-            shape = Shape(input, MAX_HIGHT);
         }
-        Shape shapeRotated = shape;
-        
-        if (!shape.isAllQuadrantCreatable()) {
-            std::cout << "Shape is not creatable due to an invalid quadrant." << std::endl;
-            continue;
+        pending.resize(left);
+        if (keys.empty()) {
+            break;
         }
-
-        if (shape.separableAxis() != -1) {
-            std::cout << "Shape is creatable due to separable." << std::endl;
-            continue;
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        for (u64 key : keys) {
+            known[key] = DB_NONE;
         }
+        creatableShapes.join(keys, [&](u64 i, u64 value) {
+            known[keys[i]] = value;
+        });
+    }
+}
 
-        if (creatableShapes.count(shapeRotated.rotateToLeast().index()) > 0) {
-            std::cout << "Shape is creatable. Method:" << std::endl;
-            std::cout << "\t" << shape;
-            while(creatableShapes.count(shapeRotated.index()) > 0) {
-                std::cout << " from:" << std::endl;
-    
-                u64 value = creatableShapes[shapeRotated.index()];
-                auto shapeFrom = Shape(getIdx(value), QUAD_SIZE, MAX_HIGHT);
-                u64 mtd = getMtd(value);
-                
-                int rotateTimes = 0;
-                shapeRotated = shapeFrom;
-                if (mtd == PIN_CODE) {
-                    shapeRotated.pin();
-                } else {
-                    shapeRotated.stackBase(stackShapes[mtd]);
-                }
-                while (shapeRotated.index() != shape.index()) {
-                    shapeRotated.rotate();
-                    rotateTimes++;
+// answer every shape of in, in the order of the input, and write the answers to out
+// async: join by the reads of async instead of the mapping of creatableShapes
+void parseBatch(const shapeDb& creatableShapes, std::istream& in, std::ostream& out, int threads, bool join,
+                asyncLookup* async = nullptr) {
+    workStealingPool pool(threads);
+    std::vector<std::string> inputs;
+    std::vector<std::string> answers;
+    u64 total = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (;;) {
+        inputs.clear();
+        std::string input;
+        while (inputs.size() < (join ? JOIN_BATCH_SIZE : BATCH_SIZE) && in >> input) {
+            inputs.push_back(input);
+        }
+        if (inputs.empty()) {
+            break;
+        }
+        answers.assign(inputs.size(), std::string());
+        if (async) {
+            answerByJoin(*async, inputs, answers, pool);
+        } else if (join) {
+            answerByJoin(creatableShapes, inputs, answers, pool);
+        } else {
+            pool.parallelFor(inputs.size(), BATCH_GRAIN, [&](u64 begin, u64 end, int) {
+                std::ostringstream answer;
+                for (u64 i = begin; i < end; i++) {
+                    answer.str("");
+                    if (!queryShape(inputs[i], creatableShapes, answer)) {
+                        answer << "Invalid hex number." << std::endl;
+                    }
+                    answers[i] = answer.str();
                 }
-    
-                std::cout << "\t" << shapeFrom.rotate(rotateTimes)
-                    << (mtd == PIN_CODE ? " pin" : (" stack: " + stackShapes[mtd].copy().rotate(rotateTimes).toString()));
-                
-                shape = shapeFrom;
-                shapeRotated = shapeFrom.rotateToLeast();
-            }
-            std::cout << std::endl;
-            continue;
+            });
+        }
+        for (const auto& answer : answers) {
+            out << answer;
         }
+        total += inputs.size();
+    }
+    out.flush();
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+    std::cerr << "Parsed " << total << " shapes in " << getTimeStringHMS(seconds) << ", "
+              << u64(total / std::max(seconds.count(), 1e-9)) << " shapes/s." << std::endl;
+}
 
-        auto toStack = shape.isCreatableNoPinToStack();
-        if (!toStack.empty()) {
-            auto stackLayers = shape.getItemsByLayer(toStack);
-            auto stackShapes = std::vector<Shape>();
-            stackShapes.push_back(shape.breakItems(toStack).removeEmptyLayers());
-            for (const auto& layer : stackLayers) {
-                stackShapes.push_back(shape.stackBase(layer));
-            }
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <shape_file> [batch_file|-] [threads] [join|async]" << std::endl;
+        std::cerr << "with a batch file (- for stdin) every shape in it is answered in order without prompts" << std::endl;
+        std::cerr << "join looks the batch up by sorted rounds that read the database in order" << std::endl;
+        std::cerr << "async joins by many concurrent reads of a flat or columns database, for one that is not in memory" << std::endl;
+        return 1;
+    }
+    auto shapeFile = argv[1];
+    const shapeDb creatableShapes(shapeFile);
 
-            std::cout << "Shape is creatable without pin. Method:" << std::endl;
-            std::cout << "\t" << stackShapes.back();
-            for (int i = stackLayers.size() - 1; i >= 0; i--) {
-                std::cout << " from: " << std::endl;
-                std::cout << "\t" << stackShapes[i] << " stack: " << stackLayers[i];
+    if (argc > 2) {
+        int threads = argc > 3 ? std::stoi(argv[3]) : 0;
+        bool async = argc > 4 && std::string(argv[4]) == "async";
+        bool join = async || (argc > 4 && std::string(argv[4]) == "join");
+        std::unique_ptr<asyncLookup> lookup;
+        if (async) {
+            if (creatableShapes.layout() != DB_FLAT && creatableShapes.layout() != DB_COLUMNS) {
+                std::cerr << "Async lookups need a flat or columns database, not " << dbLayoutName(creatableShapes.layout()) << "." << std::endl;
+                return 1;
             }
-            std::cout << std::endl;
-            continue;
+            lookup = std::make_unique<asyncLookup>(shapeFile);
+        }
+        if (threads <= 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
         }
+        if (std::string(argv[2]) == "-") {
+            std::ios::sync_with_stdio(false);
+            parseBatch(creatableShapes, std::cin, std::cout, threads, join, lookup.get());
+            return 0;
+        }
+        std::ifstream in(argv[2]);
+        if (!in.is_open()) {
+            std::cerr << "Error opening " << argv[2] << " for reading." << std::endl;
+            return 1;
+        }
+        parseBatch(creatableShapes, in, std::cout, threads, join, lookup.get());
+        return 0;
+    }
+
+    for (;;) {
+        std::string input;
+        std::cout << "Enter a shape to parse (or 'exit' to quit): " << std::endl;
+        std::cin >> input;
+        if (input == "exit") break;
 
-        std::cout << "Shape is not creatable." << std::endl;
+        if (!queryShape(input, creatableShapes, std::cout)) {
+            std::cerr << "Invalid hex number." << std::endl;
+        }
     }
 
     return 0;
-}
\ No newline at end of file
+}
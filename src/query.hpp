@@ -0,0 +1,193 @@
+#pragma once
+
+#include "main.hpp"
+
+#include <ostream>
+#include <unordered_map>
+
+// set value to the method of shape in the database, stored under its least rotation, or under its canonical shape
+// in a database without mirror images, false if neither is stored
+template <class Db>
+bool findMethod(const Db& creatableShapes, PackedShape shape, u64& value) {
+    return creatableShapes.find(shape.rotateToLeast().index(), value)
+        || creatableShapes.find(shape.toCanonical().index(), value);
+}
+
+const u64 METHOD_BROKEN = ~0ull; // a step of the database does not make its shape, or the steps do not end
+
+// call f(shapeFrom, mtd, mirrored, rotateTimes) for every step of the method of shape in the database, from the
+// shape down: shapeFrom, turned as the shape, becomes it by pin or by stacking stackShapes.code(mtd, mirrored, rotateTimes)
+// return the number of steps, 0 if the shape is not in the database, or METHOD_BROKEN after the steps that were good
+// if the database is corrupt: a method has fewer steps than the database has shapes
+template <class Db, class F>
+u64 forEachMethodStep(const Db& creatableShapes, PackedShape shapeTo, F f) {
+    u64 steps = 0;
+    u64 value;
+    while (findMethod(creatableShapes, shapeTo, value)) {
+        STATS_TIME(REPLAY);
+        STATS_COUNT(REPLAY_STEPS, 1);
+        if (++steps > creatableShapes.size()) {
+            return METHOD_BROKEN;
+        }
+        auto shapeFrom = PackedShape(getIdx(value), MAX_HIGHT);
+        u64 mtd = getMtd(value);
+
+        // the stored shape may be any rotation or mirror image of shapeTo
+        bool mirrored = false;
+        int rotateTimes = 0;
+        int transforms = 0;
+        u64 replayed = mtd == PIN_CODE ? indexPin(shapeFrom.index(), MAX_HIGHT)
+                                       : indexStackBase(shapeFrom.index(), stackShapes.code(mtd), MAX_HIGHT);
+        while (replayed != shapeTo.index()) {
+            if (++transforms == 2*QUAD_SIZE) {
+                return METHOD_BROKEN;
+            }
+            replayed = indexRotate(replayed);
+            if (++rotateTimes == QUAD_SIZE) {
+                replayed = indexMirror(replayed);
+                mirrored = true;
+                rotateTimes = 0;
+            }
+        }
+        if (mirrored) {
+            shapeFrom.mirror();
+        }
+        shapeFrom.rotate(rotateTimes);
+        f(shapeFrom, mtd, mirrored, rotateTimes);
+        shapeTo = shapeFrom;
+    }
+    return steps;
+}
+
+// write the answer of the parser for one input shape (a shape string or 0x hex) to out
+// return false without writing if the input is not a valid hex number
+// the database (a shapeDb or anything with the same find(), pending() and size()) is only read,
+// so many threads can answer at the same time
+template <class Db>
+bool queryShape(const std::string& input, const Db& creatableShapes, std::ostream& out) {
+    STATS_TIME(QUERY);
+    STATS_COUNT(QUERIES, 1);
+    Shape shape(0,0, MAX_HIGHT);
+    if (input.size() > 1 && input[0] == '0' && input[1] == 'x') {
+        // If input is a hex number, convert it to u64
+        u64 value;
+        try {
+            value = std::stoull(input.substr(2), nullptr, 16);
+        } catch (const std::logic_error&) {
+            return false;
+        }
+        shape = Shape(value, QUAD_SIZE, MAX_HIGHT);
+        out << "Shape created from hex: " << shape << std::endl;
+    } else {
+        shape = Shape(input, MAX_HIGHT);
+    }
+    // the checks below and the database only know shapes of QUAD_SIZE quadrants in every layer and at most
+    // MAX_HIGHT layers, the cell masks of a taller one may not fit in a u64
+    if (!shape.hasWidth(QUAD_SIZE) || int(shape.shape.size()) > MAX_HIGHT) {
+        STATS_COUNT(INVALID_SHAPE, 1);
+        out << "Shape is not creatable due to an invalid shape." << std::endl;
+        return true;
+    }
+    PackedShape shapeRotated = shape;
+    
+    if (!STATS_TIMED(QUADRANT, shape.isAllQuadrantCreatable())) {
+        STATS_COUNT(INVALID_QUADRANT, 1);
+        out << "Shape is not creatable due to an invalid quadrant." << std::endl;
+        return true;
+    }
+
+    if (STATS_TIMED(SEPARABLE, shape.separableAxis()) != -1) {
+        STATS_COUNT(SEPARABLE, 1);
+        out << "Shape is creatable due to separable." << std::endl;
+        return true;
+    }
+
+    // the lookup of the first step tells if the shape is in the database, the header is written with it
+    bool first = true;
+    u64 steps = forEachMethodStep(creatableShapes, shapeRotated, [&](const PackedShape& shapeFrom, u64 mtd, bool mirrored, int rotateTimes) {
+        if (first) {
+            out << "Shape is creatable. Method:" << std::endl;
+            out << "\t" << shape;
+            first = false;
+        }
+        out << " from:" << std::endl;
+        out << "\t" << shapeFrom;
+        if (mtd == PIN_CODE) {
+            out << " pin";
+        } else {
+            out << " stack: " << stackShapes.string(mtd, mirrored, rotateTimes);
+        }
+    });
+    if (steps == METHOD_BROKEN) {
+        if (!first) {
+            out << std::endl;
+        }
+        out << "Error: the method of the shape in the database is broken." << std::endl;
+        return true;
+    }
+    if (steps > 0) {
+        STATS_COUNT(METHOD, 1);
+        out << std::endl;
+        return true;
+    }
+    // a database that has not read the keys yet may still hold the shape, the answer waits for them
+    if (creatableShapes.pending()) {
+        return true;
+    }
+
+    auto toStack = STATS_TIMED(NO_PIN, shape.isCreatableNoPinToStack());
+    if (!toStack.empty()) {
+        STATS_COUNT(NO_PIN, 1);
+        auto stackLayers = shape.getItemsByLayer(toStack);
+        auto stackShapes = std::vector<Shape>();
+        stackShapes.push_back(shape.breakItems(toStack).removeEmptyLayers());
+        for (const auto& layer : stackLayers) {
+            stackShapes.push_back(shape.stackBase(layer));
+        }
+
+        out << "Shape is creatable without pin. Method:" << std::endl;
+        out << "\t" << stackShapes.back();
+        for (int i = stackLayers.size() - 1; i >= 0; i--) {
+            out << " from: " << std::endl;
+            out << "\t" << stackShapes[i] << " stack: " << stackLayers[i];
+        }
+        out << std::endl;
+        return true;
+    }
+
+    STATS_COUNT(NOT_CREATABLE, 1);
+    out << "Shape is not creatable." << std::endl;
+    return true;
+}
+
+// a database of the keys looked up so far, value DB_NONE if the key is not in the database
+// a key that is not known yet reads as not found and is added to missing,
+// so an answer is final once queryShape() ran without missing keys
+class knownLookup {
+public:
+    // size: the number of shapes in the database
+    knownLookup(const std::unordered_map<u64, u64>& known, u64 size) : known(known), size_(size) {}
+
+    bool find(u64 key, u64& value) const {
+        auto it = known.find(key);
+        if (it == known.end()) {
+            missing.push_back(key);
+            return false;
+        }
+        if (it->second == DB_NONE) {
+            return false;
+        }
+        value = it->second;
+        return true;
+    }
+
+    // true once a key was missing, the answer is not final
+    bool pending() const { return !missing.empty(); }
+    u64 size() const { return size_; }
+
+    mutable std::vector<u64> missing;
+
+private:
+    const std::unordered_map<u64, u64>& known;
+    u64 size_;
+};
@@ -0,0 +1,363 @@
+#include "main.hpp"
+#include "query.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <poll.h>
+#include <sstream>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Answer queries on a Unix socket from one mapped database, so a query costs no process start.
+// The protocol is the batch input of the parser: a client writes one shape (string or 0x hex) per line and reads
+// the answer of every line in order, each ended by an empty line. A client may write many lines before it reads,
+// the lines read together are answered as batches by a pool of workers, and the batches of one client are
+// written back in the order of its lines.
+// Only the poll loop touches the sockets, which never block: the workers append the answers to the output of the
+// client and the loop sends them when the client reads. A client with too many lines in work or answers unread
+// is not read until it catches up, so a client must read while it writes a large batch. The workers take the
+// batches of the clients in turn, so a client that writes a large batch at once does not hold up the others.
+
+const u64 JOB_LINES = 256; // lines of one client answered by one worker at a time
+const u64 READ_SIZE = 1 << 16;
+const u64 MAX_LINE = 1 << 12; // a client that writes a longer line is closed
+const u64 MAX_CLIENT_JOBS = 16; // jobs of a client read ahead of its answers
+const u64 MAX_CLIENT_OUTPUT = 1 << 20; // bytes of answers a client may leave unread before it is not read
+
+struct job {
+    u64 number;
+    std::vector<std::string> lines;
+};
+
+// a connection, closed when the poll loop and the last job of it let it go
+struct client {
+    int fd;
+    int wakeFd; // written when there are answers to send
+    std::string input; // the bytes after the last complete line
+    u64 nextJob = 0;   // the number of the next job, only used by the poll loop
+    bool inputClosed = false; // only used by the poll loop
+
+    std::deque<job> jobs; // guarded by the mutex of the jobQueue
+    bool ready = false;   // in the clients of the jobQueue
+
+    std::mutex mutex;
+    u64 unfinished = 0; // the jobs read but not answered yet
+    u64 nextWrite = 0;  // the number of the next job to write
+    std::map<u64, std::string> done; // the answers that wait for an earlier job
+    std::string output; // the answers from sent on are not sent yet
+    u64 sent = 0;
+    bool failed = false;
+
+    client(int fd, int wakeFd) : fd(fd), wakeFd(wakeFd) {}
+    ~client() { ::close(fd); }
+
+    void started() {
+        std::lock_guard<std::mutex> lock(mutex);
+        unfinished++;
+    }
+
+    // queue the answers of job and of every later job that is already done, in order
+    void finish(u64 job, std::string answers) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            unfinished--;
+            if (failed) {
+                return;
+            }
+            done[job] = std::move(answers);
+            for (auto it = done.begin(); it != done.end() && it->first == nextWrite; it = done.erase(it)) {
+                output += it->second;
+                nextWrite++;
+            }
+        }
+        u64 one = 1;
+        if (write(wakeFd, &one, sizeof(one)) < 0) {
+            // the counter is already set, the loop wakes anyway
+        }
+    }
+
+    // send what the socket takes now, false if the client can not be written any more
+    bool flush() {
+        std::lock_guard<std::mutex> lock(mutex);
+        while (sent < output.size()) {
+            ssize_t n = send(fd, output.data() + sent, output.size() - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            sent += n;
+        }
+        if (sent == output.size()) {
+            output.clear();
+            sent = 0;
+        }
+        return true;
+    }
+
+    // stop the answers and tell the client, its socket is closed once the jobs that hold it are done
+    void fail() {
+        std::lock_guard<std::mutex> lock(mutex);
+        failed = true;
+        done.clear();
+        output.clear();
+        sent = 0;
+        shutdown(fd, SHUT_RDWR);
+    }
+
+    bool backlogged() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return unfinished >= MAX_CLIENT_JOBS || output.size() - sent >= MAX_CLIENT_OUTPUT;
+    }
+    bool hasOutput() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return sent < output.size();
+    }
+    bool idle() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return unfinished == 0 && sent == output.size();
+    }
+};
+
+// the workers that answer the jobs, one job of every waiting client in turn
+class jobQueue {
+public:
+    jobQueue(const shapeDb& creatableShapes, int threads) : creatableShapes(creatableShapes) {
+        for (int i = 0; i < threads; i++) {
+            workers.emplace_back([this] { workerLoop(); });
+        }
+    }
+    ~jobQueue() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    // Delete copy constructor and copy assignment operator
+    jobQueue(const jobQueue&) = delete;
+    jobQueue& operator=(const jobQueue&) = delete;
+
+    void push(const std::shared_ptr<client>& owner, job j) {
+        owner->started();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            owner->jobs.push_back(std::move(j));
+            if (!owner->ready) {
+                owner->ready = true;
+                clients.push_back(owner);
+            }
+        }
+        wake.notify_one();
+    }
+
+private:
+    void workerLoop() {
+        std::ostringstream answer;
+        for (;;) {
+            std::shared_ptr<client> owner;
+            job j;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !clients.empty(); });
+                if (clients.empty()) {
+                    return;
+                }
+                owner = std::move(clients.front());
+                clients.pop_front();
+                j = std::move(owner->jobs.front());
+                owner->jobs.pop_front();
+                // the client waits behind the others for its next job
+                if (owner->jobs.empty()) {
+                    owner->ready = false;
+                } else {
+                    clients.push_back(owner);
+                }
+            }
+            answer.str("");
+            for (const auto& line : j.lines) {
+                // a line that fails is answered with the error, the other lines and clients go on
+                try {
+                    if (!queryShape(line, creatableShapes, answer)) {
+                        answer << "Invalid hex number." << std::endl;
+                    }
+                } catch (const std::exception& e) {
+                    answer << "Error: " << e.what() << std::endl;
+                }
+                answer << "\n";
+            }
+            owner->finish(j.number, answer.str());
+        }
+    }
+
+    const shapeDb& creatableShapes;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<std::shared_ptr<client>> clients; // the clients with jobs, in turn
+    bool stopping = false;
+    std::vector<std::thread> workers;
+};
+
+// cut the complete lines of the client input into jobs, false if a line is too long
+bool readLines(client& c, const char* data, u64 size, jobQueue& queue, const std::shared_ptr<client>& owner) {
+    c.input.append(data, size);
+    std::vector<std::string> lines;
+    u64 begin = 0;
+    for (u64 end; (end = c.input.find('\n', begin)) != std::string::npos; begin = end + 1) {
+        u64 length = end - begin;
+        if (length > 0 && c.input[end - 1] == '\r') {
+            length--;
+        }
+        if (length > 0) {
+            lines.push_back(c.input.substr(begin, length));
+        }
+        if (lines.size() == JOB_LINES) {
+            queue.push(owner, {c.nextJob++, std::move(lines)});
+            lines.clear();
+        }
+    }
+    if (!lines.empty()) {
+        queue.push(owner, {c.nextJob++, std::move(lines)});
+    }
+    c.input.erase(0, begin);
+    return c.input.size() <= MAX_LINE;
+}
+
+int listenOn(const char* path) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path too long: " << path << std::endl;
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+    // a socket left by a server that did not stop cleanly is replaced, any other file is kept
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        std::cerr << "Error listening on " << path << ": " << strerror(errno) << std::endl;
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+// read what the client wrote, false if it is to be closed
+bool readClient(const std::shared_ptr<client>& c, std::vector<char>& buffer, jobQueue& queue) {
+    ssize_t n = recv(c->fd, buffer.data(), buffer.size(), MSG_DONTWAIT);
+    if (n == 0) {
+        // the last line may have no line break, the answers are still sent
+        readLines(*c, "\n", 1, queue, c);
+        c->inputClosed = true;
+        return true;
+    }
+    if (n < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+    if (!readLines(*c, buffer.data(), n, queue, c)) {
+        std::cerr << "Closing a client with a line longer than " << MAX_LINE << " bytes." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <shape_file> <socket_path> [threads]" << std::endl;
+        std::cerr << "answers one shape per line on the socket, every answer ends with an empty line" << std::endl;
+        return 1;
+    }
+    const shapeDb creatableShapes(argv[1]);
+    int threads = argc > 3 ? std::stoi(argv[3]) : 0;
+    if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    int listener = listenOn(argv[2]);
+    if (listener < 0) {
+        return 1;
+    }
+    int wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeFd < 0) {
+        std::cerr << "Error creating an eventfd: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    // the tables of the queries are built before the first client waits for them
+    Shape("CuCuCuCu", MAX_HIGHT).separableAxis();
+    jobQueue queue(creatableShapes, threads);
+    std::cerr << "Listening on " << argv[2] << " with " << threads << " threads." << std::endl;
+
+    std::vector<std::shared_ptr<client>> clients;
+    std::vector<pollfd> fds;
+    std::vector<char> buffer(READ_SIZE);
+    for (;;) {
+        fds.assign({{listener, POLLIN, 0}, {wakeFd, POLLIN, 0}});
+        for (const auto& c : clients) {
+            short events = 0;
+            if (!c->inputClosed && !c->backlogged()) {
+                events |= POLLIN;
+            }
+            if (c->hasOutput()) {
+                events |= POLLOUT;
+            }
+            fds.push_back({c->fd, events, 0});
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Error polling: " << strerror(errno) << std::endl;
+            return 1;
+        }
+        if (fds[1].revents & POLLIN) {
+            u64 count;
+            if (read(wakeFd, &count, sizeof(count)) < 0) {
+                // another wake came first
+            }
+        }
+        u64 kept = 0;
+        for (u64 i = 0; i < clients.size(); i++) {
+            auto& c = clients[i];
+            short revents = fds[i + 2].revents;
+            bool open = (revents & (POLLERR | POLLHUP | POLLNVAL)) == 0;
+            if (open && (revents & POLLOUT)) {
+                open = c->flush();
+            }
+            if (open && (revents & POLLIN)) {
+                open = readClient(c, buffer, queue);
+            }
+            if (!open) {
+                // the jobs that hold a closed client finish without answers, then the socket is closed
+                c->fail();
+            } else if (c->inputClosed && c->idle()) {
+                shutdown(c->fd, SHUT_WR);
+            } else {
+                clients[kept++] = std::move(c);
+            }
+        }
+        clients.resize(kept);
+        if (fds[0].revents & POLLIN) {
+            int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+            if (fd >= 0) {
+                clients.push_back(std::make_shared<client>(fd, wakeFd));
+            } else if (errno != EAGAIN && errno != EINTR && errno != ECONNABORTED) {
+                std::cerr << "Error accepting: " << strerror(errno) << std::endl;
+            }
+        }
+    }
+}
@@ -94,6 +94,56 @@ u64 Shape::index() const {
     return index;
 }
 
+bool Shape::hasWidth(int width) const {
+    for (const auto& layer : shape) {
+        if (int(layer.size()) != width) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Shape::fitsCells() const {
+    return !shape.empty() && !shape[0].empty() && shape.size() * shape[0].size() <= 64;
+}
+
+cellGrid Shape::grid() const {
+    if (!shape.empty() && !fitsCells()) {
+        std::cerr << "A shape of " << shape.size() << " layers and " << shape[0].size() << " quadrants has more than 64 cells." << std::endl;
+        throw std::runtime_error("Shape too large");
+    }
+    return cellGrid(shape.empty() ? 0 : shape[0].size());
+}
+
+void Shape::typeCells(u64& cry, u64& pin, u64& ent) const {
+    cry = pin = ent = 0;
+    int width = shape.empty() ? 0 : shape[0].size();
+    for (int i = 0; i < int(shape.size()); i++) {
+        for (int j = 0; j < width; j++) {
+            u64 cell = 1ull << (i*width + j);
+            switch (shape[i][j].type) {
+            case '-':
+                break;
+            case 'c':
+                cry |= cell;
+                break;
+            case 'P':
+                pin |= cell;
+                break;
+            default:
+                ent |= cell;
+                break;
+            }
+        }
+    }
+}
+
+u64 Shape::stableCells() const {
+    u64 cry, pin, ent;
+    typeCells(cry, pin, ent);
+    return grid().stable(cry, pin, ent);
+}
+
 // this method will change all entity to Cu, all cry to cu
 Shape& Shape::rotateToLeast() {
     auto& shape = *this;
@@ -101,6 +151,10 @@ Shape& Shape::rotateToLeast() {
         return shape;
     }
     int width = shape.shape[0].size();
+    if (width == 4 && shape.shape.size() <= 8) {
+        shape = Shape(indexLeastRotation(shape.index()), width, shape.maxHight);
+        return shape;
+    }
 
     u64 minShape = shape.index();
     for (int i = 1; i < width; i++) {
@@ -155,7 +209,7 @@ u64 Shape::getQuadrantIndex(int y) const {
 }
 
 // return the items layer by layer
-std::vector<Shape> Shape::getItemsByLayer(const std::set<std::pair<int, int>>& items) const {
+std::vector<Shape> Shape::getItemsByLayer(const cellMask& items) const {
     auto& shape = *this;
     std::vector<Shape> result;
     if (shape.isEmpty()) {
@@ -193,7 +247,7 @@ int Shape::isStable(int x, int y, std::vector<std::vector<int>>& stable, bool ci
             stableBlock = 1; // Block touches the ground
             break;
         }
-        if (block.count(std::make_pair(bx-1, by)) != 0) {
+        if (block.contains(bx-1, by)) {
             continue; // The support is also in the block
         }
         if (shape.shape[bx-1][by].type == '-') {
@@ -237,6 +291,16 @@ std::vector<std::vector<int>> Shape::isStableAll(bool circleAsStable) const {
     }
     int hight = shape.shape.size();
     int width = shape.shape[0].size();
+    if (circleAsStable) {
+        u64 cry, pin, ent;
+        shape.typeCells(cry, pin, ent);
+        u64 unstable = (cry | pin | ent) & ~shape.grid().stable(cry, pin, ent);
+        std::vector<std::vector<int>> stable(hight, std::vector<int>(width, 1));
+        for (const auto& [x, y] : cellMask(unstable, width)) {
+            stable[x][y] = 0;
+        }
+        return stable;
+    }
     // -1: unknown, 0: unstable, 1: stable, -2: visiting
     std::vector<std::vector<int>> stable(hight, std::vector<int>(width, -1));
 
@@ -252,6 +316,14 @@ std::vector<std::vector<int>> Shape::isStableAll(bool circleAsStable) const {
 
 bool Shape::isStable(bool circleAsStable) const {
     auto& shape = *this;
+    if (shape.isEmpty()) {
+        return true;
+    }
+    if (circleAsStable) {
+        u64 cry, pin, ent;
+        shape.typeCells(cry, pin, ent);
+        return shape.grid().stable(cry, pin, ent) == (cry | pin | ent);
+    }
     auto stable = shape.isStableAll(circleAsStable);
     for (auto layer : stable) {
         for (auto cell : layer) {
@@ -291,57 +363,39 @@ bool Shape::isSeparable(int axis) const {
     if (shape.isEmpty()) {
         return true;
     }
-    int hight = shape.shape.size();
-    int width = shape.shape[0].size();
-    Shape left = Shape(width, hight);
-    Shape right = Shape(width, hight);
-
-    axis = axis % width + width;
-    for (int i = 0; i < hight; i++) {
-        for (int j = axis; j < axis + width/2; j++) {
-            left.shape[i][j%width] = shape.shape[i][j%width];
-        }
-        for (int j = axis + width/2; j < axis + width; j++) {
-            right.shape[i][j%width] = shape.shape[i][j%width];
-        }
-    }
-    return left.removeEmptyLayers().isStable() && right.removeEmptyLayers().isStable();
+    u64 cry, pin, ent;
+    shape.typeCells(cry, pin, ent);
+    return shape.grid().notSeparable(cry, pin, ent, axis) == 0;
 }
 
 // return the items that are not stable after divide the shape into two parts by axis
-std::set<std::pair<int, int>> Shape::notSeparableItems(int axis) const {
-    auto notSeparable = std::set<std::pair<int, int>>();
-
+cellMask Shape::notSeparableItems(int axis) const {
     auto& shape = *this;
     if (shape.isEmpty()) {
-        return notSeparable;
-    }
-    int hight = shape.shape.size();
-    int width = shape.shape[0].size();
-    Shape left = Shape(width, hight);
-    Shape right = Shape(width, hight);
-
-    axis = axis % width + width;
-    for (int i = 0; i < hight; i++) {
-        for (int j = axis; j < axis + width/2; j++) {
-            left.shape[i][j%width] = shape.shape[i][j%width];
-        }
-        for (int j = axis + width/2; j < axis + width; j++) {
-            right.shape[i][j%width] = shape.shape[i][j%width];
-        }
-    }
-
-    auto leftStable = left.isStableAll();
-    auto rightStable = right.isStableAll();
-    for (int i = 0; i < hight; i++) {
-        for (int j = 0; j < width; j++) {
-            if (leftStable[i][j] == 0 || rightStable[i][j] == 0) {
-                notSeparable.insert(std::make_pair(i, j));
+        return cellMask();
+    }
+    u64 cry, pin, ent;
+    shape.typeCells(cry, pin, ent);
+    return cellMask(shape.grid().notSeparable(cry, pin, ent, axis), shape.shape[0].size());
+}
+
+bool isHalfIndexStable(u64 half) {
+    // one bit per half index, the half is quadrants 0 and 1 of a cellGrid of width 4
+    static const std::vector<u64> table = [] {
+        const cellGrid grid(4);
+        std::vector<u64> bits(HALF_TABLE_SIZE / 64);
+        for (u64 key = 0; key < HALF_TABLE_SIZE; key++) {
+            u64 cells[4] = {};
+            for (int i = 0; i < 2*HALF_TABLE_HIGHT; i++) {
+                cells[(key >> (2*i)) & 3] |= grid.cell(i / 2, i % 2);
+            }
+            if (grid.stable(cells[1], cells[2], cells[3]) == (cells[1] | cells[2] | cells[3])) {
+                bits[key / 64] |= 1ull << (key % 64);
             }
         }
-    }
-
-    return notSeparable;
+        return bits;
+    }();
+    return half < HALF_TABLE_SIZE && ((table[half / 64] >> (half % 64)) & 1);
 }
 
 // return an axis which let the shape be separable, return -1 if the shape is not seperable
@@ -351,6 +405,9 @@ int Shape::separableAxis() const {
         return 0;
     }
     int width = shape.shape[0].size();
+    if (width == 4 && shape.shape.size() <= HALF_TABLE_HIGHT) {
+        return indexSeparableAxis(shape.index());
+    }
     for (int axis = 0; axis < width/2; axis++) {
         if (shape.isSeparable(axis)) {
             return axis;
@@ -367,111 +424,13 @@ bool Shape::isQuadrantCreatable(int y, int totalWidth, bool onlyUseWeekFall) con
     if (shape.isEmpty()) {
         return true;
     }
-    int hight = shape.shape.size();
     int width = shape.shape[0].size();
     bool more6Quad = (totalWidth == 0) ? (width >= 6) : (totalWidth >= 6);
-    
-    int cryLayer = -1; // cryLayer is the highest layer with type 'c'
-    for (cryLayer = hight-1; cryLayer >= 0; cryLayer--) {
-        if (shape.shape[cryLayer][y].type == 'c') {
-            break;
-        }
-    }
-    for (int layer = cryLayer+2; layer < hight; layer++) {
-        if (shape.shape[layer][y].type == 'P' && shape.shape[layer-1][y].type == '-') {
-            return false;
-        }
-    }
-    if (cryLayer == -1) {
-        return true;
-    }
-
-    int pinLayer = 0; // pinLayer is the first layer from down to up which type is not 'P'
-    for (pinLayer = 0; pinLayer < cryLayer; pinLayer++) {
-        if (shape.shape[pinLayer][y].type != 'P') {
-            break;
-        }
-    }
-    for (int layer = pinLayer+1; layer < cryLayer; layer++) {
-        if (shape.shape[layer][y].type == 'P') {
-            return false;
-        }
-    }
-
-    int emptyNum = 0; // emptyNum is the number of empty layers below the first cry
-    for (int layer = pinLayer; layer < cryLayer; layer++) {
-        if (shape.shape[layer][y].type == '-') {
-            emptyNum++;
-        } else if (shape.shape[layer][y].type == 'c') {
-            break;
-        }
-    }
-
-    if (!onlyUseWeekFall && (more6Quad || pinLayer > 0 || emptyNum >= 2)) {
-        bool needUp = false;
-        for (int layer = cryLayer; layer >= pinLayer; layer--) {
-            auto thistype = shape.shape[layer][y].type;
-            auto downtype = layer > pinLayer ? shape.shape[layer-1][y].type : 'G';
-            if (needUp) {
-                if (thistype == '-') {
-                    continue;
-                } else if (thistype == 'c') {
-                    return false;
-                } else { // thistype is C
-                    if (downtype == 'c') {
-                        return false;
-                    } else { // downtype is C or G or -
-                        needUp = false;
-                    }
-                }
-            } else {
-                if (thistype == '-' && downtype == 'c') {
-                    return false;
-                }
-                if (thistype == 'c' && downtype == '-') {
-                    needUp = true;
-                    layer--;
-                }
-            }
-        }
-        if (needUp) {
-            return false;
-        }
-    } else {
-        bool needUp = false;
-        for (int layer = cryLayer; layer >= pinLayer; layer--) {
-            auto thistype = shape.shape[layer][y].type;
-            auto downtype = layer > pinLayer ? shape.shape[layer-1][y].type : 'G';
-            if (needUp) {
-                if (thistype == '-') {
-                    continue;
-                } else if (thistype == 'c') {
-                    return false;
-                } else { // thistype is C
-                    if (downtype == 'c') {
-                        return false;
-                    } else if (downtype == '-') {
-                        layer--;
-                    } else { // downtype is C or G
-                        needUp = false;
-                    }
-                }
-            } else {
-                if (thistype == '-' && downtype == 'c') {
-                    return false;
-                }
-                if (thistype == 'c' && downtype == '-') {
-                    needUp = true;
-                    layer--;
-                }
-            }
-        }
-        if (needUp) {
-            return false;
-        }
+    u64 quad = shape.getQuadrantIndex(y);
+    if (quad < QUAD_TABLE_SIZE) {
+        return quadrantTables[more6Quad][onlyUseWeekFall][quad];
     }
-
-    return true;
+    return isQuadrantIndexCreatable(quad, more6Quad, onlyUseWeekFall);
 }
 
 // return true if all quadrants of the shape is creatable
@@ -482,6 +441,10 @@ bool Shape::isAllQuadrantCreatable(int totalWidth, bool onlyUseWeekFall) const {
         return true;
     }
     int width = shape.shape[0].size();
+    if (width == 4 && shape.shape.size() <= QUAD_TABLE_HIGHT) {
+        bool more6Quad = totalWidth >= 6;
+        return isAllQuadrantIndexCreatable(shape.index(), more6Quad, onlyUseWeekFall);
+    }
     for (int y = 0; y < width; y++) {
         if (!isQuadrantCreatable(y, totalWidth, onlyUseWeekFall)) {
             return false;
@@ -493,18 +456,21 @@ bool Shape::isAllQuadrantCreatable(int totalWidth, bool onlyUseWeekFall) const {
 // to use this method, the shape must be not separable
 // if the shape is creatable from a separable shape stack something, return the items to stack
 // if the shape is not creatable, or must use pin from a separable shape, return an empty set
-std::set<std::pair<int, int>> Shape::isCreatableNoPinToStack() const {
+cellMask Shape::isCreatableNoPinToStack() const {
     auto& shape = *this;
     if (shape.isEmpty()) {
-        return std::set<std::pair<int, int>>();
+        return cellMask();
     }
     int width = shape.shape[0].size();
     int hight = shape.shape.size();
+    auto grid = shape.grid();
+    u64 cry, pin, ent;
+    shape.typeCells(cry, pin, ent);
 
-    std::vector<int> cryLayer(width, -1);
+    int cryLayer[64]; // the shape fits in 64 cells, so it has at most 64 quadrants
     for (auto y = 0; y < width; y++) {
         int x = hight - 1;
-        while (x >= 0 && shape.shape[x][y].type != 'c') {
+        while (x >= 0 && !(cry & grid.cell(x, y))) {
             x--;
         }
         cryLayer[y] = x;
@@ -512,23 +478,20 @@ std::set<std::pair<int, int>> Shape::isCreatableNoPinToStack() const {
     for (int axis = 0; axis < width/2; axis++) {
         bool ok = true;
         const auto notSeparable = shape.notSeparableItems(axis);
-        std::set<std::pair<int, int>> notSeparableStack;
-        std::vector<int> lowestLayer(width, hight);
+        if (notSeparable.bits & cry) {
+            continue;
+        }
+        u64 notSeparableStack = 0;
+        int lowestLayer[64];
+        std::fill(lowestLayer, lowestLayer + width, hight);
         for (const auto& [x, y] : notSeparable) {
-            if (shape.shape[x][y].type == 'c') {
-                ok = false;
-                break;
-            }
             if (lowestLayer[y] > x) {
                 lowestLayer[y] = x;
             }
         }
-        if (!ok) {
-            continue;
-        }
         for (auto i = 1; i < hight; i++) {
             for (auto j = 0; j < width; j++) {
-                if (i < lowestLayer[j] || notSeparableStack.count({i, j}) > 0) {
+                if (i < lowestLayer[j] || (notSeparableStack & grid.cell(i, j))) {
                     continue;
                 }
                 if (shape.shape[i][j].type == '-') {
@@ -543,7 +506,7 @@ std::set<std::pair<int, int>> Shape::isCreatableNoPinToStack() const {
                 if (shape.shape[i-1][y].type != '-') {
                     isSupported = true;
                 }
-                notSeparableStack.insert({i, y});
+                notSeparableStack |= grid.cell(i, y);
                 if (shape.shape[i][y].isEntity()) {
                     for (y = (j+1)%width; y != j; y = (y+1)%width) {
                         if (cryLayer[y] >= i || !shape.shape[i][y].isEntity()) {
@@ -555,7 +518,7 @@ std::set<std::pair<int, int>> Shape::isCreatableNoPinToStack() const {
                         if (shape.shape[i-1][y].type != '-') {
                             isSupported = true;
                         }
-                        notSeparableStack.insert({i, y});
+                        notSeparableStack |= grid.cell(i, y);
                     }
                     if (y != j) {
                         for (y = (j-1+width)%width; y != j; y = (y-1+width)%width) {
@@ -568,7 +531,7 @@ std::set<std::pair<int, int>> Shape::isCreatableNoPinToStack() const {
                             if (shape.shape[i-1][y].type != '-') {
                                 isSupported = true;
                             }
-                            notSeparableStack.insert({i, y});
+                            notSeparableStack |= grid.cell(i, y);
                         }
                     }
                 }
@@ -584,12 +547,13 @@ std::set<std::pair<int, int>> Shape::isCreatableNoPinToStack() const {
         if (!ok) {
             continue;
         }
-        if (!shape.copy().breakItems(notSeparableStack).removeEmptyLayers().isSeparable(axis)) {
+        // the items to stack are never cry, breaking them only empties their cells
+        if (grid.notSeparable(cry, pin & ~notSeparableStack, ent & ~notSeparableStack, axis) != 0) {
             continue;
         }
-        return notSeparableStack;
+        return cellMask(notSeparableStack, width);
     }
-    return std::set<std::pair<int, int>>();
+    return cellMask();
 }
 
 // to use this method, the shape must be not separable
@@ -606,144 +570,50 @@ bool Shape::isCreatableNoPin() const {
 
 // do not check if the position is valid
 // return the block of cry that contains the position (x, y)
-std::set<std::pair<int, int>> Shape::findcblock(int x, int y) const {
+cellMask Shape::findcblock(int x, int y) const {
     auto& shape = *this;
     int hight = shape.shape.size();
     int width = shape.shape[0].size();
-    std::set<std::pair<int, int>> block;
     if (x < 0 || x >= hight || y < 0 || y >= width || shape.shape[x][y].type != 'c') {
-        return block;
-    }
-
-    auto visited = std::vector<std::vector<bool>>(hight, std::vector<bool>(width, false));
-    std::queue<std::pair<int, int>> q;
-    block.insert({x, y});
-    visited[x][y] = true;
-    q.push({x, y});
-    while (!q.empty()) {
-        auto [cx, cy] = q.front();
-        q.pop();
-        if (cx+1 < hight && !visited[cx+1][cy] && shape.shape[cx+1][cy].type == 'c') {
-            block.insert({cx+1, cy});
-            visited[cx+1][cy] = true;
-            q.push({cx+1, cy});
-        }
-        if (cx-1 >= 0    && !visited[cx-1][cy] && shape.shape[cx-1][cy].type == 'c') {
-            block.insert({cx-1, cy});
-            visited[cx-1][cy] = true;
-            q.push({cx-1, cy});
-        }
-        auto ty = (cy+1) % width;
-        if (!visited[cx][ty] && shape.shape[cx][ty].type == 'c') {
-            block.insert({cx, ty});
-            visited[cx][ty] = true;
-            q.push({cx, ty});
-        }
-        ty = (cy-1+width) % width;
-        if (!visited[cx][ty] && shape.shape[cx][ty].type == 'c') {
-            block.insert({cx, ty});
-            visited[cx][ty] = true;
-            q.push({cx, ty});
-        }
+        return cellMask(0, width);
     }
-    return block;
+    u64 cry, pin, ent;
+    shape.typeCells(cry, pin, ent);
+    auto grid = shape.grid();
+    return cellMask(grid.findCrystal(grid.cell(x, y), cry), width);
 }
 
 // do not check if the position is valid
 // return the block of items that contains the position (x, y)
-std::set<std::pair<int,int>> Shape::findblock(int x, int y) const {
+cellMask Shape::findblock(int x, int y) const {
     auto& shape = *this;
     int hight = shape.shape.size();
     int width = shape.shape[0].size();
-    std::set<std::pair<int, int>> block;
     if (x < 0 || x >= hight || y < 0 || y >= width || shape.shape[x][y].type == '-') {
-        return block;
+        return cellMask(0, width);
     }
-
-    auto visited = std::vector<std::vector<bool>>(hight, std::vector<bool>(width, false));
-    std::queue<std::pair<int, int>> q;
-    block.insert({x, y});
-    visited[x][y] = true;
-    q.push({x, y});
-    while (!q.empty()) {
-        auto [cx, cy] = q.front();
-        q.pop();
-        Item currentItem = shape.shape[cx][cy];
-        if (currentItem.type == '-') {
-            continue;
-        }
-        if (currentItem.type == 'P') {
-            continue;
-        }
-        if (currentItem.type == 'c') {
-            if (cx+1 < hight && !visited[cx+1][cy] && shape.shape[cx+1][cy].type == 'c') {
-                block.insert({cx+1, cy});
-                visited[cx+1][cy] = true;
-                q.push({cx+1, cy});
-            }
-            if (cx-1 >= 0    && !visited[cx-1][cy] && shape.shape[cx-1][cy].type == 'c') {
-                block.insert({cx-1, cy});
-                visited[cx-1][cy] = true;
-                q.push({cx-1, cy});
-            }
-        }
-        if (currentItem.type == 'c' || currentItem.isEntity()) {
-            auto ty = (cy+1) % width;
-            if (!visited[cx][ty] && (shape.shape[cx][ty].type == 'c' || shape.shape[cx][ty].isEntity())) {
-                block.insert({cx, ty});
-                visited[cx][ty] = true;
-                q.push({cx, ty});
-            }
-            ty = (cy-1+width) % width;
-            if (!visited[cx][ty] && (shape.shape[cx][ty].type == 'c' || shape.shape[cx][ty].isEntity())) {
-                block.insert({cx, ty});
-                visited[cx][ty] = true;
-                q.push({cx, ty});
-            }
-        }
-    }
-    return block;
+    u64 cry, pin, ent;
+    shape.typeCells(cry, pin, ent);
+    auto grid = shape.grid();
+    return cellMask(grid.findBlock(grid.cell(x, y), cry, ent), width);
 }
 
 // do not check if the position is valid
 // return the block of items that contains the position (x, y), ignore all cry items
-std::set<std::pair<int,int>> Shape::findeblock(int x, int y) const {
+cellMask Shape::findeblock(int x, int y) const {
     auto& shape = *this;
     int hight = shape.shape.size();
     int width = shape.shape[0].size();
-    std::set<std::pair<int, int>> block;
     if (x < 0 || x >= hight || y < 0 || y >= width || shape.shape[x][y].type == '-' || shape.shape[x][y].type == 'c') {
-        return block;
+        return cellMask(0, width);
     }
-
-    auto visited = std::vector<std::vector<bool>>(hight, std::vector<bool>(width, false));
-    std::queue<std::pair<int, int>> q;
-    block.insert({x, y});
-    visited[x][y] = true;
-    q.push({x, y});
-    while (!q.empty()) {
-        auto [cx, cy] = q.front();
-        q.pop();
-        Item currentItem = shape.shape[cx][cy];
-        if (currentItem.type == '-' || currentItem.type == 'P' || currentItem.type == 'c') {
-            continue;
-        }
-        if (currentItem.isEntity()) {
-            auto ty = (cy+1) % width;
-            if (!visited[cx][ty] && shape.shape[cx][ty].isEntity()) {
-                block.insert({cx, ty});
-                visited[cx][ty] = true;
-                q.push({cx, ty});
-            }
-            ty = (cy-1+width) % width;
-            if (!visited[cx][ty] && shape.shape[cx][ty].isEntity()) {
-                block.insert({cx, ty});
-                visited[cx][ty] = true;
-                q.push({cx, ty});
-            }
-        }
+    if (shape.shape[x][y].type == 'P') {
+        return cellMask(grid().cell(x, y), width);
     }
-    return block;
+    u64 cry, pin, ent;
+    shape.typeCells(cry, pin, ent);
+    auto grid = shape.grid();
+    return cellMask(grid.findEntity(grid.cell(x, y), ent), width);
 }
 
 // do not check if the position is valid
@@ -785,10 +655,15 @@ Shape& Shape::breakQuadrant(int y) {
 
 // do not check if the position is valid
 // do not remove the empty layers
-Shape& Shape::breakItems(const std::set<std::pair<int, int>>& items) {
+Shape& Shape::breakItems(const cellMask& items) {
     auto& shape = *this;
-    for (const auto& [x, y] : items) {
-        shape.breakItem(x, y);
+    if (items.empty()) {
+        return shape;
+    }
+    u64 cry, pin, ent;
+    shape.typeCells(cry, pin, ent);
+    for (const auto& [x, y] : cellMask(items.bits | shape.grid().findCrystal(items.bits, cry), items.width)) {
+        shape.shape[x][y] = Item('-', '-');
     }
     return shape;
 }
@@ -871,47 +746,36 @@ Shape& Shape::fall() {
     if (shape.isEmpty()) {
         return shape;
     }
-    int hight = shape.shape.size();
     int width = shape.shape[0].size();
 
-    auto stable = shape.isStableAll();
-    for (int i = 0; i < hight; i++) {
-        for (int j = 0; j < width; j++) {
-            if (stable[i][j] == 0 && shape.shape[i][j].type == 'c') {
-                shape.shape[i][j] = Item('-', '-');
-            }
-        }
-    }
-
-    for (int i = 0; i < hight; i++) {
-        for (int j = 0; j < width; j++) {
-            if (stable[i][j] == 0 && shape.shape[i][j].type != '-') {
-                auto block = shape.findblock(i, j);
-                int fallTo = i - 2;
-                for(;;) {
-                    if (fallTo < 0) {
-                        fallTo = 0;
-                        break;
-                    }
-                    bool canFall = true;
-                    for (const auto& [bx, by] : block) {
-                        if (shape.shape[fallTo][by].type != '-') {
-                            canFall = false;
-                            break;
-                        }
-                    }
-                    if (!canFall) {
-                        fallTo++;
-                        break;
-                    }
-                    fallTo--;
-                }
-                for (const auto& [bx, by] : block) {
-                    shape.shape[fallTo][by] = shape.shape[bx][by];
-                    shape.shape[bx][by] = Item('-', '-');
-                }
-            }
-        }
+    auto grid = shape.grid();
+    u64 cry, pin, ent;
+    shape.typeCells(cry, pin, ent);
+    u64 unstable = (cry | pin | ent) & ~grid.stable(cry, pin, ent);
+    for (const auto& [x, y] : cellMask(unstable & cry, width)) {
+        shape.shape[x][y] = Item('-', '-');
+    }
+    cry &= ~unstable;
+    // the unstable blocks fall in the order of their lowest cell, the cells of a block land in one layer
+    for (u64 rest = unstable & ~cry & (pin | ent); rest; rest &= pin | ent) {
+        int i = std::countr_zero(rest) / width;
+        u64 block = grid.findBlock(rest & -rest, cry, ent);
+        u64 quads = 0;
+        for (const auto& [x, y] : cellMask(block, width)) {
+            quads |= 1ull << y;
+        }
+        u64 filled = cry | pin | ent;
+        int fallTo = i - 2;
+        while (fallTo >= 0 && !(grid.down(filled, fallTo) & quads)) {
+            fallTo--;
+        }
+        fallTo = std::max(fallTo + 1, 0);
+        for (const auto& [x, y] : cellMask(block, width)) {
+            shape.shape[fallTo][y] = shape.shape[x][y];
+            shape.shape[x][y] = Item('-', '-');
+        }
+        rest &= ~block;
+        shape.typeCells(cry, pin, ent);
     }
     shape.removeEmptyLayers();
     return shape;
@@ -922,16 +786,11 @@ Shape& Shape::rotate(int times) {
     if (shape.isEmpty()) {
         return shape;
     }
-    int hight = shape.shape.size();
     int width = shape.shape[0].size();
-    Shape rotated(width, hight, shape.maxHight);
-    times = times % width;
-    for (int i = 0; i < hight; i++) {
-        for (int j = 0; j < width; j++) {
-            rotated.shape[i][j] = shape.shape[i][(j-times+width) % width];
-        }
+    times = (times % width + width) % width;
+    for (auto& layer : shape.shape) {
+        std::rotate(layer.begin(), layer.begin() + (width - times) % width, layer.end());
     }
-    shape.shape = rotated.shape;
     return shape;
 }
 
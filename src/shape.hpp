@@ -6,6 +6,8 @@
 #include <queue>
 #include <set>
 #include <algorithm>
+#include <bit>
+#include <stdexcept>
 
 struct Item {
     char type = '-';
@@ -32,6 +34,325 @@ struct Item {
 
 typedef u_int64_t u64;
 
+// the index of a quadrant has 2 bits per layer from down to up, as Shape::getQuadrantIndex()
+// return true if the quadrant is creatable, the same rules as Shape::isQuadrantCreatable()
+constexpr bool isQuadrantIndexCreatable(u64 quad, bool more6Quad, bool onlyUseWeekFall) {
+    // 0: -, 1: c, 2: P, 3: C, 4: the ground below the quadrant
+    auto type = [quad](int layer) { return layer < 0 ? 4 : int((quad >> (2*layer)) & 0b11); };
+    int hight = 0;
+    for (u64 rest = quad; rest != 0; rest >>= 2) {
+        hight++;
+    }
+
+    int cryLayer = -1; // cryLayer is the highest layer with type 'c'
+    for (cryLayer = hight-1; cryLayer >= 0; cryLayer--) {
+        if (type(cryLayer) == 1) {
+            break;
+        }
+    }
+    for (int layer = cryLayer+2; layer < hight; layer++) {
+        if (type(layer) == 2 && type(layer-1) == 0) {
+            return false;
+        }
+    }
+    if (cryLayer == -1) {
+        return true;
+    }
+
+    int pinLayer = 0; // pinLayer is the first layer from down to up which type is not 'P'
+    for (pinLayer = 0; pinLayer < cryLayer; pinLayer++) {
+        if (type(pinLayer) != 2) {
+            break;
+        }
+    }
+    for (int layer = pinLayer+1; layer < cryLayer; layer++) {
+        if (type(layer) == 2) {
+            return false;
+        }
+    }
+
+    int emptyNum = 0; // emptyNum is the number of empty layers below the first cry
+    for (int layer = pinLayer; layer < cryLayer; layer++) {
+        if (type(layer) == 0) {
+            emptyNum++;
+        } else if (type(layer) == 1) {
+            break;
+        }
+    }
+
+    bool strongFall = !onlyUseWeekFall && (more6Quad || pinLayer > 0 || emptyNum >= 2);
+    bool needUp = false;
+    for (int layer = cryLayer; layer >= pinLayer; layer--) {
+        int thistype = type(layer);
+        int downtype = layer > pinLayer ? type(layer-1) : 4;
+        if (needUp) {
+            if (thistype == 0) {
+                continue;
+            } else if (thistype == 1) {
+                return false;
+            } else { // thistype is C
+                if (downtype == 1) {
+                    return false;
+                } else if (downtype == 0 && !strongFall) {
+                    layer--;
+                } else { // downtype is C or G, or - with the strong fall
+                    needUp = false;
+                }
+            }
+        } else {
+            if (thistype == 0 && downtype == 1) {
+                return false;
+            }
+            if (thistype == 1 && downtype == 0) {
+                needUp = true;
+                layer--;
+            }
+        }
+    }
+    return !needUp;
+}
+
+// one bit per quadrant index for every quadrant of hight at most QUAD_TABLE_HIGHT
+const int QUAD_TABLE_HIGHT = 5;
+const u64 QUAD_TABLE_SIZE = 1ull << (2*QUAD_TABLE_HIGHT);
+
+struct QuadrantTable {
+    u64 bits[QUAD_TABLE_SIZE / 64] = {};
+
+    constexpr QuadrantTable(bool more6Quad, bool onlyUseWeekFall) {
+        for (u64 quad = 0; quad < QUAD_TABLE_SIZE; quad++) {
+            if (isQuadrantIndexCreatable(quad, more6Quad, onlyUseWeekFall)) {
+                bits[quad / 64] |= 1ull << (quad % 64);
+            }
+        }
+    }
+    constexpr bool operator[](u64 quad) const {
+        return (bits[quad / 64] >> (quad % 64)) & 1;
+    }
+};
+
+// quadrantTables[more6Quad][onlyUseWeekFall]
+constexpr QuadrantTable quadrantTables[2][2] = {
+    {QuadrantTable(false, false), QuadrantTable(false, true)},
+    {QuadrantTable(true, false), QuadrantTable(true, true)},
+};
+
+// return the index of the quadrant y of a 4 quadrants shape index
+inline u64 indexQuadrant(u64 index, int y) {
+    u64 x = (index >> (2*y)) & 0x0303030303030303;
+    x = (x | (x >> 6))  & 0x000F000F000F000F;
+    x = (x | (x >> 12)) & 0x000000FF000000FF;
+    x = (x | (x >> 24)) & 0x000000000000FFFF;
+    return x;
+}
+
+// return true if all quadrants of a 4 quadrants shape index are creatable
+// the index must have at most QUAD_TABLE_HIGHT layers
+inline bool isAllQuadrantIndexCreatable(u64 index, bool more6Quad = false, bool onlyUseWeekFall = false) {
+    const auto& table = quadrantTables[more6Quad][onlyUseWeekFall];
+    return table[indexQuadrant(index, 0)] && table[indexQuadrant(index, 1)]
+        && table[indexQuadrant(index, 2)] && table[indexQuadrant(index, 3)];
+}
+
+// rotate a 4 quadrants shape index as Shape::rotate(), every layer is a byte rotated by 2 bits per quadrant
+constexpr u64 indexRotate(u64 index, int times = 1) {
+    int shift = 2 * (times & 3);
+    const u64 keep = 0x0101010101010101 * ((0xFFull << shift) & 0xFF);
+    return ((index << shift) & keep) | ((index >> (8 - shift)) & ~keep);
+}
+
+// quadrant y goes to quadrant 3-y
+constexpr u64 indexMirror(u64 index) {
+    index = ((index >> 4) & 0x0F0F0F0F0F0F0F0F) | ((index & 0x0F0F0F0F0F0F0F0F) << 4);
+    return ((index >> 2) & 0x3333333333333333) | ((index & 0x3333333333333333) << 2);
+}
+
+// the least index of the rotations, as Shape::rotateToLeast()
+constexpr u64 indexLeastRotation(u64 index) {
+    return std::min(std::min(index, indexRotate(index, 1)), std::min(indexRotate(index, 2), indexRotate(index, 3)));
+}
+
+// the least index of the rotations of the shape and its mirror image
+constexpr u64 indexCanonical(u64 index) {
+    return std::min(indexLeastRotation(index), indexLeastRotation(indexMirror(index)));
+}
+
+// The cell masks of a shape with width quadrants, one bit per cell, bit (layer*width + quadrant).
+// A u64 holds the cells of 64/width layers, the cell methods of Shape need a shape of at most 64 cells.
+struct cellGrid {
+    int width = 0;
+    int layers = 0;
+    u64 all = 0;       // every cell of the layers that fit
+    u64 firstQuad = 0; // quadrant 0 in every layer
+    u64 lastQuad = 0;  // quadrant width-1 in every layer
+
+    constexpr cellGrid(int width) : width(width), layers(width > 0 ? 64 / width : 0) {
+        if (width <= 0) {
+            return;
+        }
+        for (int x = 0; x < layers; x++) {
+            firstQuad |= 1ull << (x*width);
+        }
+        lastQuad = firstQuad << (width - 1);
+        all = layers * width == 64 ? ~0ull : (1ull << (layers * width)) - 1;
+    }
+
+    constexpr u64 cell(int x, int y) const { return 1ull << (x*width + y); }
+    constexpr u64 layer(int x) const { return (~0ull >> (64 - width)) << (x*width); }
+    constexpr u64 up(u64 cells) const { return (cells << width) & all; }
+    constexpr u64 down(u64 cells, int layers = 1) const { return cells >> (layers*width); }
+    // move every cell from quadrant y to y+1, and to y-1
+    constexpr u64 next(u64 cells) const { return ((cells & ~lastQuad) << 1) | ((cells & lastQuad) >> (width - 1)); }
+    constexpr u64 prev(u64 cells) const { return ((cells & ~firstQuad) >> 1) | ((cells & firstQuad) << (width - 1)); }
+    // the quadrants from axis to axis+width/2-1 in every layer, one half of Shape::isSeparable()
+    constexpr u64 half(int axis) const {
+        u64 cells = 0;
+        for (int j = axis; j < axis + width/2; j++) {
+            cells |= firstQuad << ((j % width + width) % width);
+        }
+        return cells;
+    }
+
+    // the block of items that contains the seed cells, as Shape::findblock()
+    constexpr u64 findBlock(u64 seed, u64 cry, u64 ent) const {
+        const u64 joint = cry | ent;
+        for (u64 block = seed;;) {
+            u64 c = block & cry;
+            u64 j = block & joint;
+            u64 grown = block | ((up(c) | down(c)) & cry) | ((next(j) | prev(j)) & joint);
+            if (grown == block) {
+                return block;
+            }
+            block = grown;
+        }
+    }
+    // the crystals connected to the seed crystals, as Shape::findcblock()
+    constexpr u64 findCrystal(u64 seed, u64 cry) const {
+        for (u64 block = seed & cry;;) {
+            u64 grown = block | ((up(block) | down(block) | next(block) | prev(block)) & cry);
+            if (grown == block) {
+                return block;
+            }
+            block = grown;
+        }
+    }
+    // the entities connected to the seed entities in their layers, as Shape::findeblock()
+    constexpr u64 findEntity(u64 seed, u64 ent) const {
+        for (u64 block = seed & ent;;) {
+            u64 grown = block | ((next(block) | prev(block)) & ent);
+            if (grown == block) {
+                return block;
+            }
+            block = grown;
+        }
+    }
+    // the items that are not stable when the two halves of the axis stand alone, as Shape::notSeparableItems()
+    constexpr u64 notSeparable(u64 cry, u64 pin, u64 ent, int axis) const {
+        u64 left = half(axis);
+        u64 unstable = 0;
+        for (u64 side : {left, all & ~left}) {
+            unstable |= (cry | pin | ent) & side & ~stable(cry & side, pin & side, ent & side);
+        }
+        return unstable;
+    }
+    // the stable items, circles are stable as Shape::isStableAll()
+    // a block is unstable unless it touches the ground or stands on a stable item of another block
+    constexpr u64 stable(u64 cry, u64 pin, u64 ent) const {
+        u64 filled = cry | pin | ent;
+        u64 blocks[64];
+        int count = 0;
+        for (u64 rest = filled; rest; ) {
+            blocks[count] = findBlock(rest & -rest, cry, ent);
+            rest &= ~blocks[count++];
+        }
+        u64 stable = filled;
+        for (bool changed = true; changed; ) {
+            changed = false;
+            for (int i = 0; i < count; i++) {
+                u64 block = blocks[i];
+                if (!(block & stable) || (block & layer(0)) || (down(block) & ~block & stable)) {
+                    continue;
+                }
+                stable &= ~block;
+                changed = true;
+            }
+        }
+        return stable;
+    }
+};
+
+// a set of cells in the masks of a cellGrid of the width
+// iterates the (layer, quadrant) of the cells from down to up, the order of a std::set of the pairs
+struct cellMask {
+    u64 bits = 0;
+    int width = 0;
+
+    constexpr cellMask() = default;
+    constexpr cellMask(u64 bits, int width) : bits(bits), width(width) {}
+
+    bool operator==(const cellMask& other) const { return bits == other.bits; }
+    bool operator!=(const cellMask& other) const { return !(*this == other); }
+
+    constexpr bool empty() const { return bits == 0; }
+    constexpr int size() const { return std::popcount(bits); }
+    constexpr bool contains(int x, int y) const { return x >= 0 && y >= 0 && y < width && x*width + y < 64 && ((bits >> (x*width + y)) & 1); }
+    constexpr void insert(int x, int y) { bits |= 1ull << (x*width + y); }
+    // the quadrants of layer x, bit y for quadrant y
+    constexpr u64 layer(int x) const { return x*width >= 64 ? 0 : (bits >> (x*width)) & (~0ull >> (64 - width)); }
+
+    class iterator {
+    public:
+        constexpr iterator(u64 rest, int width) : rest(rest), width(width) {}
+        constexpr std::pair<int, int> operator*() const {
+            int bit = std::countr_zero(rest);
+            return {bit / width, bit % width};
+        }
+        constexpr iterator& operator++() {
+            rest &= rest - 1;
+            return *this;
+        }
+        constexpr bool operator!=(const iterator& other) const { return rest != other.rest; }
+
+    private:
+        u64 rest;
+        int width;
+    };
+    constexpr iterator begin() const { return iterator(bits, width); }
+    constexpr iterator end() const { return iterator(0, width); }
+};
+
+// the index of a half has 4 bits per layer from down to up, quadrant axis and quadrant axis+1
+// a half of a 4 quadrants shape, as one side of Shape::isSeparable()
+const int HALF_TABLE_HIGHT = 5;
+const u64 HALF_TABLE_SIZE = 1ull << (4*HALF_TABLE_HIGHT);
+
+inline u64 indexHalf(u64 index, int axis) {
+    int shift = 2 * (axis & 3);
+    u64 x = ((index >> shift) & (0x0101010101010101ull * (0xFF >> shift)))
+          | ((index << (8 - shift)) & (0x0101010101010101ull * ((0xFF << (8 - shift)) & 0xFF)));
+    x &= 0x0F0F0F0F0F0F0F0F;
+    x = (x | (x >> 4))  & 0x00FF00FF00FF00FF;
+    x = (x | (x >> 8))  & 0x0000FFFF0000FFFF;
+    x = (x | (x >> 16)) & 0x00000000FFFFFFFF;
+    return x;
+}
+
+// return true if all items of the half are stable, the table is built on the first call
+bool isHalfIndexStable(u64 half);
+
+// the same as Shape::separableAxis() for a 4 quadrants shape index of at most HALF_TABLE_HIGHT layers
+inline int indexSeparableAxis(u64 index) {
+    if (index == 0) {
+        return 0;
+    }
+    for (int axis = 0; axis < 2; axis++) {
+        if (isHalfIndexStable(indexHalf(index, axis)) && isHalfIndexStable(indexHalf(index, axis + 2))) {
+            return axis;
+        }
+    }
+    return -1;
+}
+
 // layers are from down to up, quadrants are clockwise
 class Shape {
 public:
@@ -47,6 +368,7 @@ public:
     bool operator==(const Shape& other) const { return shape == other.shape; }
     bool operator!=(const Shape& other) const { return !(*this == other); }
     bool isEmpty() const { return shape.empty(); }
+    bool hasWidth(int width) const; // every layer has width quadrants
 
     Shape copy() const { return Shape(*this); }
 
@@ -57,27 +379,33 @@ public:
 
     Shape getQuadrant(int y) const;
     u64 getQuadrantIndex(int y) const;
-    std::vector<Shape> getItemsByLayer(const std::set<std::pair<int, int>>& items) const;
+    std::vector<Shape> getItemsByLayer(const cellMask& items) const;
 
     std::vector<std::vector<int>> isStableAll(bool circleAsStable = true) const;
     bool isStable(bool circleAsStable = true) const;
     bool isCompact() const;
     bool isSeparable(int axis) const;
-    std::set<std::pair<int, int>> notSeparableItems(int axis) const;
+    cellMask notSeparableItems(int axis) const;
     int separableAxis() const; // -1: not seperable, other: the seperable axis
     bool isQuadrantCreatable(int y, int totalWidth = 0, bool onlyUseWeekFall = false) const;
     bool isAllQuadrantCreatable(int totalWidth = 0, bool onlyUseWeekFall = false) const;
-    std::set<std::pair<int, int>> isCreatableNoPinToStack() const;
+    cellMask isCreatableNoPinToStack() const;
     bool isCreatableNoPin() const;
 
-    std::set<std::pair<int,int>> findcblock(int x, int y) const;
-    std::set<std::pair<int,int>> findblock(int x, int y) const;
-    std::set<std::pair<int,int>> findeblock(int x, int y) const;
+    // the cell masks of the cellGrid of the width, grid() throws unless fitsCells()
+    bool fitsCells() const;
+    cellGrid grid() const;
+    void typeCells(u64& cry, u64& pin, u64& ent) const;
+    u64 stableCells() const; // the stable items, as isStableAll()
+
+    cellMask findcblock(int x, int y) const;
+    cellMask findblock(int x, int y) const;
+    cellMask findeblock(int x, int y) const;
 
     Shape& breakItem(int x, int y);
     Shape& breakLayer(int x);
     Shape& breakQuadrant(int y);
-    Shape& breakItems(const std::set<std::pair<int, int>>& items);
+    Shape& breakItems(const cellMask& items);
 
     Shape& removeEmptyLayers();
     Shape& addEmptyLayersUp(int count = 1);
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "shape.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SHAPE_BATCH_AVX2
+#endif
+
+// The functions of one 4 quadrants shape index in shape.hpp over arrays of indices, out may be the input.
+// On x86 the AVX2 kernels take 4 indices per instruction. They are compiled for AVX2 whatever the build
+// flags and only run if the CPU has AVX2, so the same binary falls back to the scalar loop elsewhere.
+
+#ifdef SHAPE_BATCH_AVX2
+inline bool hasAvx2() {
+    static const bool has = [] {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") != 0;
+    }();
+    return has;
+}
+
+// indexRotate() of 4 indices
+template <int times>
+__attribute__((target("avx2"))) inline __m256i indexRotate4(__m256i index) {
+    constexpr int shift = 2 * times;
+    const __m256i keep = _mm256_set1_epi64x(0x0101010101010101 * ((0xFFull << shift) & 0xFF));
+    return _mm256_or_si256(_mm256_and_si256(_mm256_slli_epi64(index, shift), keep),
+                           _mm256_andnot_si256(keep, _mm256_srli_epi64(index, 8 - shift)));
+}
+
+// indexMirror() of 4 indices
+__attribute__((target("avx2"))) inline __m256i indexMirror4(__m256i index) {
+    const __m256i nibbles = _mm256_set1_epi64x(0x0F0F0F0F0F0F0F0F);
+    const __m256i pairs = _mm256_set1_epi64x(0x3333333333333333);
+    index = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi64(index, 4), nibbles),
+                            _mm256_slli_epi64(_mm256_and_si256(index, nibbles), 4));
+    return _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi64(index, 2), pairs),
+                           _mm256_slli_epi64(_mm256_and_si256(index, pairs), 2));
+}
+
+// the unsigned minimum of 4 pairs of indices
+__attribute__((target("avx2"))) inline __m256i indexMin4(__m256i a, __m256i b) {
+    const __m256i sign = _mm256_set1_epi64x(1ll << 63);
+    __m256i greater = _mm256_cmpgt_epi64(_mm256_xor_si256(a, sign), _mm256_xor_si256(b, sign));
+    return _mm256_blendv_epi8(a, b, greater);
+}
+
+// indexLeastRotation() of 4 indices
+__attribute__((target("avx2"))) inline __m256i indexLeastRotation4(__m256i index) {
+    return indexMin4(indexMin4(index, indexRotate4<1>(index)), indexMin4(indexRotate4<2>(index), indexRotate4<3>(index)));
+}
+
+// indexQuadrant() of 4 indices
+template <int y>
+__attribute__((target("avx2"))) inline __m256i indexQuadrant4(__m256i index) {
+    __m256i x = _mm256_and_si256(_mm256_srli_epi64(index, 2*y), _mm256_set1_epi64x(0x0303030303030303));
+    x = _mm256_and_si256(_mm256_or_si256(x, _mm256_srli_epi64(x, 6)), _mm256_set1_epi64x(0x000F000F000F000F));
+    x = _mm256_and_si256(_mm256_or_si256(x, _mm256_srli_epi64(x, 12)), _mm256_set1_epi64x(0x000000FF000000FF));
+    return _mm256_and_si256(_mm256_or_si256(x, _mm256_srli_epi64(x, 24)), _mm256_set1_epi64x(0xFFFF));
+}
+
+// the bits of 4 quadrant indices in a QuadrantTable, 1 or 0 in every lane
+__attribute__((target("avx2"))) inline __m256i quadrantTableBits4(const QuadrantTable& table, __m256i quad) {
+    __m256i words = _mm256_i64gather_epi64(reinterpret_cast<const long long*>(table.bits), _mm256_srli_epi64(quad, 6), 8);
+    return _mm256_and_si256(_mm256_srlv_epi64(words, _mm256_and_si256(quad, _mm256_set1_epi64x(63))), _mm256_set1_epi64x(1));
+}
+
+// the kernels return how many indices they did, a multiple of 4
+__attribute__((target("avx2"))) inline u64 leastRotationIndicesAvx2(const u64* indices, u64* out, u64 count) {
+    u64 i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i index = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(indices + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), indexLeastRotation4(index));
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) inline u64 canonicalIndicesAvx2(const u64* indices, u64* out, u64 count) {
+    u64 i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i index = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(indices + i));
+        __m256i least = indexMin4(indexLeastRotation4(index), indexLeastRotation4(indexMirror4(index)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), least);
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) inline u64 allQuadrantCreatableFlagsAvx2(const u64* indices, bool* flags, u64 count,
+                                                                       const QuadrantTable& table) {
+    u64 i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i index = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(indices + i));
+        __m256i creatable = _mm256_and_si256(
+            _mm256_and_si256(quadrantTableBits4(table, indexQuadrant4<0>(index)), quadrantTableBits4(table, indexQuadrant4<1>(index))),
+            _mm256_and_si256(quadrantTableBits4(table, indexQuadrant4<2>(index)), quadrantTableBits4(table, indexQuadrant4<3>(index))));
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_slli_epi64(creatable, 63)));
+        for (int k = 0; k < 4; k++) {
+            flags[i + k] = (mask >> k) & 1;
+        }
+    }
+    return i;
+}
+#endif
+
+// out[i] = indexLeastRotation(indices[i])
+inline void leastRotationIndices(const u64* indices, u64* out, u64 count) {
+    u64 i = 0;
+#ifdef SHAPE_BATCH_AVX2
+    if (hasAvx2()) {
+        i = leastRotationIndicesAvx2(indices, out, count);
+    }
+#endif
+    for (; i < count; i++) {
+        out[i] = indexLeastRotation(indices[i]);
+    }
+}
+
+// out[i] = indexCanonical(indices[i])
+inline void canonicalIndices(const u64* indices, u64* out, u64 count) {
+    u64 i = 0;
+#ifdef SHAPE_BATCH_AVX2
+    if (hasAvx2()) {
+        i = canonicalIndicesAvx2(indices, out, count);
+    }
+#endif
+    for (; i < count; i++) {
+        out[i] = indexCanonical(indices[i]);
+    }
+}
+
+// flags[i] = isAllQuadrantIndexCreatable(indices[i]), the indices must have at most QUAD_TABLE_HIGHT layers
+inline void allQuadrantCreatableFlags(const u64* indices, bool* flags, u64 count, bool more6Quad = false, bool onlyUseWeekFall = false) {
+    u64 i = 0;
+#ifdef SHAPE_BATCH_AVX2
+    if (hasAvx2()) {
+        i = allQuadrantCreatableFlagsAvx2(indices, flags, count, quadrantTables[more6Quad][onlyUseWeekFall]);
+    }
+#endif
+    for (; i < count; i++) {
+        flags[i] = isAllQuadrantIndexCreatable(indices[i], more6Quad, onlyUseWeekFall);
+    }
+}
@@ -0,0 +1,204 @@
+#pragma once
+
+#include "dblayout.hpp"
+
+// a read-only shape database in any dbLayout, the layout is read from the file when it is opened
+// a flat or columns database also uses the radix directory next to it if there is one
+// all lookups are const and can be shared by many threads
+
+const u64 JOIN_SCAN_RATIO = 64; // an unsorted layout is read whole by join() for more than size/64 keys
+
+class shapeDb {
+public:
+    shapeDb(const char* filename, bool populate = false, int advice = MADV_RANDOM) : file(filename, populate, advice) {
+        dbHeader header;
+        if (file.size() >= sizeof(header)) {
+            memcpy(&header, file.data(), sizeof(header));
+        }
+        if (file.size() >= sizeof(header) && header.magic == DB_MAGIC) {
+            if (header.layout != DB_EYTZINGER && header.layout != DB_BTREE && header.layout != DB_ELIAS_FANO
+                && header.layout != DB_COLUMNS) {
+                std::cerr << "Unknown layout " << header.layout << " in " << filename << std::endl;
+                throw std::runtime_error("File format error");
+            }
+            layout_ = dbLayout(header.layout);
+            size_ = header.size;
+            slots_ = header.slots;
+            keys_ = reinterpret_cast<const u64*>(file.data() + header.keyOffset);
+            values_ = reinterpret_cast<const u64*>(file.data() + header.valueOffset);
+            if (layout_ == DB_ELIAS_FANO) {
+                coded = eliasFano(keys_, efSizes(size_, header.reserved[0], header.reserved[1]));
+            }
+            if (layout_ == DB_COLUMNS) {
+                directory = std::make_unique<radixDirectory>(filename, size_);
+            }
+        } else {
+            layout_ = DB_FLAT;
+            size_ = file.size() / (2*sizeof(u64));
+            slots_ = size_;
+            keys_ = reinterpret_cast<const u64*>(file.data());
+            values_ = keys_ + 1;
+            directory = std::make_unique<radixDirectory>(filename, size_);
+        }
+        std::cerr << "Mapped " << size_ << " items from " << filename << " (" << dbLayoutName(layout_) << ")." << std::endl;
+    }
+
+    // Delete copy constructor and copy assignment operator
+    shapeDb(const shapeDb&) = delete;
+    shapeDb& operator=(const shapeDb&) = delete;
+
+    void advise(int advice) const {
+        file.advise(advice);
+    }
+
+    // return true and set value if idx is in the database
+    bool find(u64 idx, u64& value) const {
+        u64 slot = findSlot(idx);
+        if (slot == DB_NONE) {
+            return false;
+        }
+        STATS_COUNT(LOOKUP_HITS, 1);
+        value = valueAt(slot);
+        return true;
+    }
+
+    int count(u64 idx) const {
+        if (findSlot(idx) == DB_NONE) {
+            return 0;
+        }
+        STATS_COUNT(LOOKUP_HITS, 1);
+        return 1;
+    }
+
+    // every lookup is answered at once, see knownLookup for one that is not
+    bool pending() const { return false; }
+
+    // return 0 if not found
+    u64 operator[](u64 idx) const {
+        u64 value = 0;
+        find(idx, value);
+        return value;
+    }
+
+    // call f(idx, value) for every item in increasing idx
+    template <class F>
+    void forEach(F f) const {
+        switch (layout_) {
+        case DB_FLAT:
+            for (u64 i = 0; i < size_; i++) {
+                f(keys_[2*i], values_[2*i]);
+            }
+            break;
+        case DB_EYTZINGER:
+            forEachSlot(eytzingerOrder(size_), f);
+            break;
+        case DB_BTREE:
+            forEachSlot(btreeOrder(slots_), f);
+            break;
+        case DB_ELIAS_FANO:
+            coded.forEach([&](u64 i, u64 idx) { f(idx, valueAt(i)); });
+            break;
+        case DB_COLUMNS:
+            forEachSlot(linearOrder(), f);
+            break;
+        case DB_RADIX:
+        case DB_LAYOUTS:
+            // the constructor maps no other layout
+            throw std::runtime_error("File format error");
+        }
+    }
+
+    // call f(i, value) for every keys[i] in the database, keys must be sorted
+    // sorted layouts are read front to back, skipping ahead by galloping, so a large batch streams the file once
+    template <class F>
+    void join(const std::vector<u64>& keys, F f) const {
+        STATS_TIME(JOIN);
+        STATS_COUNT(JOIN_KEYS, keys.size());
+        if (layout_ == DB_FLAT || layout_ == DB_COLUMNS) {
+            u64 stride = layout_ == DB_FLAT ? 2 : 1;
+            u64 pos = 0;
+            for (u64 i = 0; i < keys.size() && pos < size_; i++) {
+                u64 step = 1;
+                while (pos + step < size_ && keys_[stride*(pos + step)] < keys[i]) {
+                    step *= 2;
+                }
+                pos = sortedLowerBound(keys_, stride, pos + step / 2, std::min(pos + step + 1, size_), keys[i]);
+                if (pos < size_ && keys_[stride*pos] == keys[i]) {
+                    f(i, valueAt(pos));
+                }
+            }
+        } else if (keys.size() > size_ / JOIN_SCAN_RATIO) {
+            u64 i = 0;
+            forEach([&](u64 idx, u64 value) {
+                while (i < keys.size() && keys[i] < idx) {
+                    i++;
+                }
+                if (i < keys.size() && keys[i] == idx) {
+                    f(i, value);
+                }
+            });
+        } else {
+            for (u64 i = 0; i < keys.size(); i++) {
+                u64 slot = findSlot(keys[i]);
+                if (slot != DB_NONE) {
+                    STATS_COUNT(LOOKUP_HITS, 1);
+                    f(i, valueAt(slot));
+                }
+            }
+        }
+    }
+
+    dbLayout layout() const { return layout_; }
+    u64 size() const { return size_; }
+
+private:
+    mappedFile file;
+    std::unique_ptr<radixDirectory> directory;
+    dbLayout layout_ = DB_FLAT;
+    u64 size_ = 0;
+    u64 slots_ = 0;
+    const u64* keys_ = nullptr;
+    const u64* values_ = nullptr;
+    eliasFano coded; // the keys of DB_ELIAS_FANO
+
+    u64 valueAt(u64 slot) const {
+        switch (layout_) {
+        case DB_FLAT:
+            return values_[2*slot];
+        case DB_ELIAS_FANO:
+            return efValue(reinterpret_cast<const char*>(values_), slot);
+        default:
+            return values_[slot];
+        }
+    }
+
+    u64 findSlot(u64 idx) const {
+        STATS_TIME(LOOKUP);
+        STATS_COUNT(LOOKUPS, 1);
+        switch (layout_) {
+        case DB_EYTZINGER:
+            return eytzingerFind(keys_, size_, idx);
+        case DB_BTREE:
+            return btreeFind(keys_, slots_, idx);
+        case DB_ELIAS_FANO:
+            return coded.find(idx);
+        default: {
+            // flat and columns, the columns search touches only the keys
+            u64 left = 0;
+            u64 right = size_;
+            if (directory && !directory->range(idx, left, right)) {
+                return DB_NONE;
+            }
+            return sortedFind(keys_, layout_ == DB_FLAT ? 2 : 1, left, right, idx);
+        }
+        }
+    }
+
+    template <class Order, class F>
+    void forEachSlot(Order order, F& f) const {
+        for (u64 i = 0; i < size_; i++) {
+            u64 slot = order.next();
+            f(keys_[slot], values_[slot]);
+        }
+    }
+};
@@ -0,0 +1,109 @@
+#include "shapez2.h"
+
+#include "main.hpp"
+#include "query.hpp"
+
+// The C interface of shapez2.h over the same code as the parser, on shape codes instead of strings.
+
+struct shapez2_db {
+    shapeDb creatableShapes;
+
+    explicit shapez2_db(const char* path) : creatableShapes(path) {}
+};
+
+const u64 STATUS_BATCH = 256; // shapes checked together by the quadrant kernels
+
+int shapez2_api_version(void) {
+    return SHAPEZ2_API_VERSION;
+}
+
+shapez2_db* shapez2_open(const char* path) {
+    try {
+        return new shapez2_db(path);
+    } catch (const std::exception& e) {
+        std::cerr << "Error opening database " << path << ": " << e.what() << std::endl;
+        return nullptr;
+    }
+}
+
+void shapez2_close(shapez2_db* db) {
+    delete db;
+}
+
+uint64_t shapez2_size(const shapez2_db* db) {
+    return db->creatableShapes.size();
+}
+
+void shapez2_canonicalize(const uint64_t* shapes, uint64_t* out, size_t count) {
+    canonicalIndices(shapes, out, count);
+}
+
+// the same order of checks as queryShape()
+void shapez2_is_creatable(const shapez2_db* db, const uint64_t* shapes, uint8_t* status, size_t count) {
+    bool quadrantsCreatable[STATUS_BATCH];
+    u64 codes[STATUS_BATCH];
+    for (size_t begin = 0; begin < count; begin += STATUS_BATCH) {
+        u64 n = std::min<u64>(count - begin, STATUS_BATCH);
+        // the quadrant tables only hold MAX_HIGHT layers, a longer code is checked as an empty one
+        for (u64 i = 0; i < n; i++) {
+            codes[i] = shapes[begin + i] > MAX_INDEX ? 0 : shapes[begin + i];
+        }
+        allQuadrantCreatableFlags(codes, quadrantsCreatable, n);
+        for (u64 i = 0; i < n; i++) {
+            u64 code = shapes[begin + i];
+            uint8_t& s = status[begin + i];
+            if (code > MAX_INDEX) {
+                s = SHAPEZ2_INVALID_SHAPE;
+            } else if (!quadrantsCreatable[i]) {
+                s = SHAPEZ2_INVALID_QUADRANT;
+            } else if (indexSeparableAxis(code) != -1) {
+                s = SHAPEZ2_SEPARABLE;
+            } else if (u64 steps = forEachMethodStep(db->creatableShapes, PackedShape(code, MAX_HIGHT),
+                                                     [](const PackedShape&, u64, bool, int) {}); steps > 0) {
+                // the whole method is replayed, a status of SHAPEZ2_METHOD has its steps in shapez2_recipes()
+                s = steps == METHOD_BROKEN ? SHAPEZ2_BROKEN_METHOD : SHAPEZ2_METHOD;
+            } else if (!Shape(code, QUAD_SIZE, MAX_HIGHT).isCreatableNoPinToStack().empty()) {
+                s = SHAPEZ2_NO_PIN;
+            } else {
+                s = SHAPEZ2_NOT_CREATABLE;
+            }
+        }
+    }
+}
+
+size_t shapez2_recipes(const shapez2_db* db, const uint64_t* shapes, size_t count,
+                       shapez2_step* steps, size_t capacity, size_t* offsets) {
+    size_t used = 0;
+    offsets[0] = 0;
+    for (size_t i = 0; i < count; i++) {
+        bool fits = true;
+        // only the shapes of status SHAPEZ2_METHOD, the parser answers the others before the database
+        u64 code = shapes[i];
+        if (code <= MAX_INDEX && isAllQuadrantIndexCreatable(code) && indexSeparableAxis(code) == -1) {
+            u64 stepCount = forEachMethodStep(db->creatableShapes, PackedShape(code, MAX_HIGHT),
+                              [&](const PackedShape& shapeFrom, u64 mtd, bool mirrored, int rotateTimes) {
+                if (used == capacity) {
+                    fits = false;
+                    return;
+                }
+                shapez2_step& step = steps[used++];
+                step.from = shapeFrom.index();
+                step.stack = mtd == PIN_CODE ? 0 : stackShapes.code(mtd, mirrored, rotateTimes);
+                step.method = mtd;
+                step.mirrored = mirrored;
+                step.rotation = rotateTimes;
+                step.reserved = 0;
+            });
+            // a broken method has no steps, as its status is not SHAPEZ2_METHOD
+            if (stepCount == METHOD_BROKEN) {
+                used = offsets[i];
+                fits = true;
+            }
+        }
+        if (!fits) {
+            return i;
+        }
+        offsets[i + 1] = used;
+    }
+    return count;
+}
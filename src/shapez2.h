@@ -0,0 +1,82 @@
+#ifndef SHAPEZ2_H
+#define SHAPEZ2_H
+
+/*
+ * The C interface of the parser, built as a shared library:
+ *
+ *     g++ -std=c++2a -O2 -pthread -shared -fPIC -fvisibility=hidden src/shapez2.cpp -o libshapez2.so
+ *
+ * Shapes are 4 quadrant codes of Shape::index(): 2 bits per quadrant from quadrant 0, one byte per layer
+ * from the bottom, 0 is '-', 1 is 'c', 2 is 'P' and 3 any other item, at most 5 layers.
+ * Every call works on arrays and writes into buffers of the caller, nothing is allocated for the results.
+ * A database may be used by many threads at once.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__)
+#define SHAPEZ2_API __attribute__((visibility("default")))
+#else
+#define SHAPEZ2_API
+#endif
+
+#define SHAPEZ2_API_VERSION 2
+
+/* the answer of the parser for a shape */
+enum shapez2_status {
+    SHAPEZ2_INVALID_SHAPE = 0,    /* more than 5 layers */
+    SHAPEZ2_INVALID_QUADRANT = 1, /* not creatable due to an invalid quadrant */
+    SHAPEZ2_SEPARABLE = 2,        /* creatable due to separable */
+    SHAPEZ2_METHOD = 3,           /* creatable by the method in the database, see shapez2_recipes() */
+    SHAPEZ2_NO_PIN = 4,           /* creatable without pin by stacking its layers */
+    SHAPEZ2_NOT_CREATABLE = 5,
+    SHAPEZ2_BROKEN_METHOD = 6     /* in the database, but its method does not replay, the database is corrupt */
+};
+
+#define SHAPEZ2_PIN 0xFF
+
+/* one step of a method: from becomes the shape before it by pin (method SHAPEZ2_PIN) or by stacking stack */
+typedef struct shapez2_step {
+    uint64_t from;   /* turned as the shape before the step */
+    uint64_t stack;  /* the stacked shape turned the same way, 0 for pin */
+    uint32_t method; /* the stack shape number of the parser, or SHAPEZ2_PIN */
+    uint8_t mirrored; /* stack is the mirror image of the stack shape ... */
+    uint8_t rotation; /* ... rotated clockwise by rotation quadrants */
+    uint16_t reserved;
+} shapez2_step;
+
+typedef struct shapez2_db shapez2_db;
+
+SHAPEZ2_API int shapez2_api_version(void);
+
+/* map a database of the parser in any layout, NULL with a message on stderr if it can not be read */
+SHAPEZ2_API shapez2_db* shapez2_open(const char* path);
+SHAPEZ2_API void shapez2_close(shapez2_db* db);
+SHAPEZ2_API uint64_t shapez2_size(const shapez2_db* db);
+
+/* out[i] = the least of the rotations and mirror images of shapes[i], out may be shapes */
+SHAPEZ2_API void shapez2_canonicalize(const uint64_t* shapes, uint64_t* out, size_t count);
+
+/* status[i] = the enum shapez2_status of shapes[i], the method of a shape in the database is replayed to check it */
+SHAPEZ2_API void shapez2_is_creatable(const shapez2_db* db, const uint64_t* shapes, uint8_t* status, size_t count);
+
+/*
+ * Write the steps of the methods of the shapes in the database, from each shape down, into steps.
+ * The steps of shapes[i] are steps[offsets[i]] to steps[offsets[i+1]-1], a shape has none unless its status is
+ * SHAPEZ2_METHOD.
+ * Return the number of shapes written, less than count if the next one did not fit in capacity steps,
+ * offsets must have room for count+1 items.
+ */
+SHAPEZ2_API size_t shapez2_recipes(const shapez2_db* db, const uint64_t* shapes, size_t count,
+                                   shapez2_step* steps, size_t capacity, size_t* offsets);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
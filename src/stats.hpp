@@ -0,0 +1,256 @@
+#pragma once
+
+#include "shape.hpp"
+
+// Counters and stage timers of the query pipeline, compiled in only with QUERY_STATS (see main.hpp).
+// Every thread adds to its own slot, so the hot path has no locks or atomic read-modify-writes.
+// The totals of all threads are written to stderr at exit, on SIGUSR1 (the program goes on) and on SIGINT or
+// SIGTERM (the program ends), as a table or as JSON with QUERY_STATS_FORMAT=json in the environment.
+// The stages nest: lookup runs inside replay, and every stage runs inside query. The join answers a shape
+// by rounds, so its queries are counted once per round.
+
+#define STATS_COUNTERS(X)                   \
+    X(QUERIES, "queries")                   \
+    X(INVALID_SHAPE, "invalid_shape")       \
+    X(INVALID_QUADRANT, "invalid_quadrant") \
+    X(SEPARABLE, "separable")               \
+    X(METHOD, "method")                     \
+    X(NO_PIN, "no_pin")                     \
+    X(NOT_CREATABLE, "not_creatable")       \
+    X(REPLAY_STEPS, "replay_steps")         \
+    X(LOOKUPS, "lookups")                   \
+    X(LOOKUP_HITS, "lookup_hits")           \
+    X(PROBES, "probes")                     \
+    X(SEEKS, "seeks")                       \
+    X(BYTES_READ, "bytes_read")             \
+    X(JOIN_KEYS, "join_keys")
+
+#define STATS_STAGES(X)       \
+    X(QUERY, "query")         \
+    X(QUADRANT, "quadrant")   \
+    X(SEPARABLE, "separable") \
+    X(REPLAY, "replay")       \
+    X(LOOKUP, "lookup")       \
+    X(JOIN, "join")           \
+    X(NO_PIN, "no_pin")
+
+#define STATS_COUNTER_ENUM(name, label) COUNTER_##name,
+#define STATS_STAGE_ENUM(name, label) STAGE_##name,
+enum statsCounter { STATS_COUNTERS(STATS_COUNTER_ENUM) STATS_COUNTER_COUNT };
+enum statsStage { STATS_STAGES(STATS_STAGE_ENUM) STATS_STAGE_COUNT };
+#undef STATS_COUNTER_ENUM
+#undef STATS_STAGE_ENUM
+
+#ifdef QUERY_STATS
+
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <pthread.h>
+#include <thread>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// the time stamp counter, or nanoseconds where there is none
+inline u64 readCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// only the owning thread writes a slot, the others read it with relaxed loads
+struct queryStats {
+    std::atomic<u64> counts[STATS_COUNTER_COUNT] = {};
+    std::atomic<u64> calls[STATS_STAGE_COUNT] = {};
+    std::atomic<u64> cycles[STATS_STAGE_COUNT] = {};
+
+    static void add(std::atomic<u64>& x, u64 n) {
+        x.store(x.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    void addTo(queryStats& total) const {
+        for (int i = 0; i < STATS_COUNTER_COUNT; i++) {
+            add(total.counts[i], counts[i].load(std::memory_order_relaxed));
+        }
+        for (int i = 0; i < STATS_STAGE_COUNT; i++) {
+            add(total.calls[i], calls[i].load(std::memory_order_relaxed));
+            add(total.cycles[i], cycles[i].load(std::memory_order_relaxed));
+        }
+    }
+};
+
+// the slots of the running threads and the totals of the finished ones
+// it is never destroyed, threads may end after the static destructors
+class queryStatsRegistry {
+public:
+    static queryStatsRegistry& get() {
+        static queryStatsRegistry* registry = new queryStatsRegistry();
+        return *registry;
+    }
+
+    void attach(queryStats* stats) {
+        std::lock_guard<std::mutex> lock(mutex);
+        live.push_back(stats);
+        threads++;
+    }
+    void detach(queryStats* stats) {
+        std::lock_guard<std::mutex> lock(mutex);
+        stats->addTo(retired);
+        live.erase(std::find(live.begin(), live.end(), stats));
+    }
+
+    // the totals of all threads and the number of threads that counted
+    u64 total(queryStats& sum) {
+        std::lock_guard<std::mutex> lock(mutex);
+        retired.addTo(sum);
+        for (const queryStats* stats : live) {
+            stats->addTo(sum);
+        }
+        return threads;
+    }
+
+    // the cycles of readCycles() per nanosecond, measured since the start of the program
+    double cyclesPerNs() const {
+        std::chrono::duration<double, std::nano> ns = std::chrono::steady_clock::now() - startTime;
+        return ns.count() > 0 ? (readCycles() - startCycles) / ns.count() : 1;
+    }
+
+private:
+    queryStatsRegistry() : startTime(std::chrono::steady_clock::now()), startCycles(readCycles()) {}
+
+    std::mutex mutex;
+    std::vector<queryStats*> live;
+    queryStats retired;
+    u64 threads = 0;
+    std::chrono::steady_clock::time_point startTime;
+    u64 startCycles;
+};
+
+struct queryStatsSlot {
+    queryStats stats;
+    queryStatsSlot() { queryStatsRegistry::get().attach(&stats); }
+    ~queryStatsSlot() { queryStatsRegistry::get().detach(&stats); }
+};
+
+inline queryStats& threadQueryStats() {
+    thread_local queryStatsSlot slot;
+    return slot.stats;
+}
+
+inline void statsCount(statsCounter counter, u64 n) {
+    queryStats::add(threadQueryStats().counts[counter], n);
+}
+
+// times the scope as one call of the stage
+class statsTimer {
+public:
+    explicit statsTimer(statsStage stage) : stage(stage), start(readCycles()) {}
+    ~statsTimer() {
+        u64 cycles = readCycles() - start;
+        auto& stats = threadQueryStats();
+        queryStats::add(stats.calls[stage], 1);
+        queryStats::add(stats.cycles[stage], cycles);
+    }
+
+    statsTimer(const statsTimer&) = delete;
+    statsTimer& operator=(const statsTimer&) = delete;
+
+private:
+    statsStage stage;
+    u64 start;
+};
+
+// write the totals to stderr with one fprintf per line, the answers on stdout are not mixed in
+inline void dumpQueryStats() {
+    static const char* counterNames[] = {
+#define STATS_NAME(name, label) label,
+        STATS_COUNTERS(STATS_NAME)
+    };
+    static const char* stageNames[] = {
+        STATS_STAGES(STATS_NAME)
+#undef STATS_NAME
+    };
+    auto& registry = queryStatsRegistry::get();
+    queryStats sum;
+    u64 threads = registry.total(sum);
+    double cyclesPerNs = registry.cyclesPerNs();
+    auto ns = [&](int stage) { return sum.cycles[stage].load() / cyclesPerNs; };
+    const char* format = getenv("QUERY_STATS_FORMAT");
+    if (format && std::string(format) == "json") {
+        fprintf(stderr, "{\"threads\": %" PRIu64 ", \"cycles_per_ns\": %.4f, \"stages\": {", threads, cyclesPerNs);
+        for (int i = 0; i < STATS_STAGE_COUNT; i++) {
+            fprintf(stderr, "%s\"%s\": {\"calls\": %" PRIu64 ", \"cycles\": %" PRIu64 ", \"ns\": %.0f}", i ? ", " : "",
+                    stageNames[i], sum.calls[i].load(), sum.cycles[i].load(), ns(i));
+        }
+        fprintf(stderr, "}, \"counters\": {");
+        for (int i = 0; i < STATS_COUNTER_COUNT; i++) {
+            fprintf(stderr, "%s\"%s\": %" PRIu64, i ? ", " : "", counterNames[i], sum.counts[i].load());
+        }
+        fprintf(stderr, "}}\n");
+        return;
+    }
+    fprintf(stderr, "Query stats of %" PRIu64 " threads, %.3f cycles/ns:\n", threads, cyclesPerNs);
+    fprintf(stderr, "%-12s %14s %14s %12s\n", "Stage", "Calls", "Total (ms)", "Mean (ns)");
+    for (int i = 0; i < STATS_STAGE_COUNT; i++) {
+        u64 calls = sum.calls[i].load();
+        fprintf(stderr, "%-12s %14" PRIu64 " %14.3f %12.1f\n", stageNames[i], calls, ns(i) / 1e6, calls ? ns(i) / calls : 0.0);
+    }
+    fprintf(stderr, "%-20s %14s\n", "Counter", "Value");
+    for (int i = 0; i < STATS_COUNTER_COUNT; i++) {
+        fprintf(stderr, "%-20s %14" PRIu64 "\n", counterNames[i], sum.counts[i].load());
+    }
+}
+
+// block the dump signals in the main thread before any other thread starts, so they all inherit the mask,
+// and wait for them in a thread of their own where the dump is safe
+inline bool installQueryStats() {
+    queryStatsRegistry::get();
+    static sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    std::thread([] {
+        for (;;) {
+            int signal = 0;
+            if (sigwait(&signals, &signal) != 0) {
+                return;
+            }
+            dumpQueryStats();
+            if (signal != SIGUSR1) {
+                // end the program as the signal would have
+                std::signal(signal, SIG_DFL);
+                sigset_t one;
+                sigemptyset(&one);
+                sigaddset(&one, signal);
+                pthread_sigmask(SIG_UNBLOCK, &one, nullptr);
+                raise(signal);
+            }
+        }
+    }).detach();
+    atexit(dumpQueryStats);
+    return true;
+}
+
+inline const bool queryStatsInstalled = installQueryStats();
+
+// STATS_COUNT(LOOKUPS, 1) adds to a counter, STATS_TIME(LOOKUP) times the rest of the scope,
+// STATS_TIMED(LOOKUP, expr) times one expression and is its value
+#define STATS_COUNT(counter, n) statsCount(COUNTER_##counter, n)
+#define STATS_TIME(stage) statsTimer statsTimer_##stage(STAGE_##stage)
+#define STATS_TIMED(stage, expr) ([&]() { STATS_TIME(stage); return expr; }())
+
+#else
+
+#define STATS_COUNT(counter, n) ((void)0)
+#define STATS_TIME(stage) ((void)0)
+#define STATS_TIMED(stage, expr) (expr)
+
+#endif
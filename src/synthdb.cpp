@@ -0,0 +1,81 @@
+#include "main.hpp"
+
+#include <random>
+#include <unordered_map>
+
+// Build a synthetic database of a given size in any layout the parser reads.
+// The shapes grow from the single layers by random pin() and stackBase() steps of the generator, so every value
+// is a real method and the parser follows the chains to a seed or a separable shape as in the real database.
+// Half of the parents are drawn from the newest shapes, which gives the chains the depth of the later levels.
+
+const u64 RECENT_PARENTS = 1024;
+const u64 TRIES_PER_SHAPE = 1000; // give up if the shapes stop growing
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <out_file> <shapes> [flat|eytzinger|btree|radix|eliasfano|columns] [seed]" << std::endl;
+        std::cerr << "builds a database of about shapes random methods, the same seed builds the same database" << std::endl;
+        return 1;
+    }
+    u64 target = std::stoull(argv[2]);
+    dbLayout layout = DB_FLAT;
+    if (argc > 3 && !parseDbLayout(argv[3], layout)) {
+        std::cerr << "Unknown layout: " << argv[3] << std::endl;
+        return 1;
+    }
+    std::mt19937_64 rng(argc > 4 ? std::stoull(argv[4]) : TEST_POINTS);
+
+    auto start = std::chrono::steady_clock::now();
+    std::unordered_map<u64, int> depth; // the steps from a seed of every shape found, by least rotation
+    std::vector<u64> found;
+    for (u64 code = 1; code < 0x100; code++) {
+        u64 key = indexLeastRotation(code);
+        if (depth.emplace(key, 0).second) {
+            found.push_back(key);
+        }
+    }
+    std::vector<std::pair<u64, u64>> items; // (idx, value)
+    u64 tries = 0;
+    u64 totalDepth = 0;
+    int maxDepth = 0;
+    while (items.size() < target && tries < TRIES_PER_SHAPE * (target + 1)) {
+        tries++;
+        u64 recent = std::min<u64>(found.size(), RECENT_PARENTS);
+        u64 parent = rng() % 2 ? found[found.size() - 1 - rng() % recent] : found[rng() % found.size()];
+        u64 mtd = rng() % (MAX_MTD_MAIN + 1);
+        mtd = mtd == MAX_MTD_MAIN ? PIN_CODE : mtd;
+        u64 key = indexLeastRotation(mtd == PIN_CODE ? indexPin(parent, MAX_HIGHT)
+                                                     : indexStackBase(parent, stackShapes.code(mtd), MAX_HIGHT));
+        if (key == 0 || key == parent || depth.count(key) > 0) {
+            continue;
+        }
+        int d = depth[parent] + 1;
+        depth[key] = d;
+        found.push_back(key);
+        // the seeds and separable shapes are not stored, as in the generator
+        if (indexSeparableAxis(key) == -1) {
+            items.push_back({key, CreateValue(parent, mtd)});
+            totalDepth += d;
+            maxDepth = std::max(maxDepth, d);
+        }
+    }
+    if (items.size() < target) {
+        std::cerr << "Warning: only " << items.size() << " shapes were found." << std::endl;
+    }
+    std::sort(items.begin(), items.end());
+    std::cerr << "Found " << items.size() << " shapes in " << getTimeStringHMS(std::chrono::steady_clock::now() - start)
+              << ", mean depth " << (items.empty() ? 0.0 : double(totalDepth) / items.size()) << ", max depth " << maxDepth << "." << std::endl;
+
+    auto forEach = [&](auto f) {
+        for (const auto& [idx, value] : items) {
+            f(idx, value);
+        }
+    };
+    if (layout == DB_RADIX) {
+        if (!saveDb(argv[1], DB_FLAT, items.size(), forEach)) {
+            return 1;
+        }
+        return saveRadix((std::string(argv[1]) + RADIX_SUFFIX).c_str(), items.size(), forEach) ? 0 : 1;
+    }
+    return saveDb(argv[1], layout, items.size(), forEach) ? 0 : 1;
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include "shape.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// a pool of threads that run parallelFor() loops
+// every worker starts with an equal range of the loop, takes grain items at a time from its front,
+// and when it runs out steals the back half of the largest range left
+class workStealingPool {
+public:
+    explicit workStealingPool(int threads) : ranges(std::max(threads, 1)) {
+        for (int i = 1; i < int(ranges.size()); i++) {
+            workers.emplace_back([this, i] { workerLoop(i); });
+        }
+    }
+    ~workStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    // Delete copy constructor and copy assignment operator
+    workStealingPool(const workStealingPool&) = delete;
+    workStealingPool& operator=(const workStealingPool&) = delete;
+
+    int size() const { return ranges.size(); }
+
+    // call f(begin, end, worker) on pieces of [0, count) until all of it is done, worker is from 0 to size()-1
+    // the calling thread is worker 0, calls must not be nested
+    void parallelFor(u64 count, u64 grain, const std::function<void(u64, u64, int)>& f) {
+        if (count == 0) {
+            return;
+        }
+        grain = std::max<u64>(grain, 1);
+        u64 n = ranges.size();
+        for (u64 i = 0; i < n; i++) {
+            std::lock_guard<std::mutex> lock(ranges[i].mutex);
+            ranges[i].begin = count * i / n;
+            ranges[i].end = count * (i + 1) / n;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &f;
+            jobGrain = grain;
+            running = n - 1;
+            generation++;
+        }
+        wake.notify_all();
+        runJob(0);
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return running == 0; });
+        job = nullptr;
+    }
+
+private:
+    struct range {
+        std::mutex mutex;
+        u64 begin = 0;
+        u64 end = 0;
+    };
+
+    std::vector<range> ranges;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(u64, u64, int)>* job = nullptr;
+    u64 jobGrain = 1;
+    u64 generation = 0;
+    int running = 0;
+    bool stopping = false;
+
+    void workerLoop(int worker) {
+        u64 seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping) {
+                    return;
+                }
+                seen = generation;
+            }
+            runJob(worker);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--running == 0) {
+                done.notify_one();
+            }
+        }
+    }
+
+    // take the next piece of the own range, return false if it is empty
+    bool take(int worker, u64& begin, u64& end) {
+        auto& own = ranges[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (own.begin >= own.end) {
+            return false;
+        }
+        begin = own.begin;
+        end = std::min(own.end, begin + jobGrain);
+        own.begin = end;
+        return true;
+    }
+
+    // move the back half of the largest other range to the own range, return false if all are empty
+    bool steal(int worker) {
+        int n = ranges.size();
+        int victim = -1;
+        u64 most = 0;
+        for (int i = 0; i < n; i++) {
+            if (i == worker) {
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(ranges[i].mutex);
+            u64 left = ranges[i].end - std::min(ranges[i].begin, ranges[i].end);
+            if (left > most) {
+                most = left;
+                victim = i;
+            }
+        }
+        if (victim < 0) {
+            return false;
+        }
+        u64 begin, end;
+        {
+            std::lock_guard<std::mutex> lock(ranges[victim].mutex);
+            if (ranges[victim].begin >= ranges[victim].end) {
+                return true; // taken in the meantime, look again
+            }
+            u64 half = (ranges[victim].end - ranges[victim].begin + 1) / 2;
+            end = ranges[victim].end;
+            begin = end - half;
+            ranges[victim].end = begin;
+        }
+        std::lock_guard<std::mutex> lock(ranges[worker].mutex);
+        ranges[worker].begin = begin;
+        ranges[worker].end = end;
+        return true;
+    }
+
+    void runJob(int worker) {
+        u64 begin, end;
+        for (;;) {
+            while (take(worker, begin, end)) {
+                (*job)(begin, end, worker);
+            }
+            if (!steal(worker)) {
+                return;
+            }
+        }
+    }
+};